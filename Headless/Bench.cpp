@@ -0,0 +1,872 @@
+//
+// Bench.cpp
+// jsexec_bench: cost of crossing the JS -> C++ boundary through GlobalFunctions.
+//
+// Every sample runs a script that calls one global function in a loop and
+// reports the per-call average. Samples are then sorted for p50/p99. The
+// "(empty loop)" row is the loop cost without a call; "net" subtracts its mean.
+// Allocations are C++ heap allocations made by the host (operator new), the
+// engine's own GC heap isn't counted.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "BytecodeCache.h"
+#include "CommandRing.h"
+#include "ConsoleRecorder.h"
+#include "JsWrapper.h"
+#include "JsrtCompat.h"
+#include "OutputBuffer.h"
+#include "OutputStore.h"
+#include "RuntimeThread.h"
+#include "SamplingProfiler.h"
+#include "ScriptExecutor.h"
+#include "WrapperPool.h"
+
+namespace
+{
+	std::atomic<unsigned long long> g_allocations { 0 };
+	std::atomic<unsigned long long> g_allocatedBytes { 0 };
+}
+
+void* operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace
+{
+	// Keeps the work an IConsole would do (the string arrives and gets looked at)
+	// without paying for any output.
+	class NullConsole : public JsWrapper::IConsole
+	{
+	public:
+		void Append(JsWrapper::StringView text) override { m_chars += text.Length(); }
+		void SetColor(JsWrapper::StringView hexColor) override { m_chars += hexColor.Length(); }
+		void Rotate(double x, double y, double z) override { m_sum += x + y + z; }
+
+	private:
+		size_t m_chars { 0 };
+		double m_sum { 0 };
+	};
+
+	// NullConsole taking console_log text as UTF-8, like StreamConsole.
+	class NullUtf8Console : public NullConsole
+	{
+	public:
+		bool WantsUtf8() const override { return true; }
+		void AppendUtf8(JsWrapper::Utf8View text) override { m_bytes += text.Length(); }
+
+	private:
+		size_t m_bytes { 0 };
+	};
+
+	struct Options
+	{
+		unsigned samples { 200 };
+		unsigned batch { 1000 };
+		const char* szFilter { nullptr };
+	};
+
+	struct Result
+	{
+		std::string name;
+		unsigned long long calls;
+		double meanNs;
+		double p50Ns;
+		double p99Ns;
+		double allocsPerCall;
+	};
+
+	double Percentile(const std::vector<double>& sorted, double p)
+	{
+		size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+
+	void Print(const Result& result, double baselineNs)
+	{
+		std::printf("%-22s %10llu %10.1f %10.1f %10.1f %10.1f %8.2f\n",
+			result.name.c_str(), result.calls, result.meanNs, result.meanNs - baselineNs, result.p50Ns, result.p99Ns, result.allocsPerCall);
+	}
+
+	Result Measure(JsWrapper::IJsWrapper& wrapper, const char* szName, const std::wstring& script, unsigned callsPerSample, unsigned samples)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		for (int i = 0; i < 3; i++)
+		{
+			wrapper.Execute(script);
+			JsWrapper::RunEventLoop(wrapper);
+		}
+
+		std::vector<double> nsPerCall;
+		nsPerCall.reserve(samples);
+		unsigned long long allocations = 0;
+		double totalNs = 0;
+
+		for (unsigned s = 0; s < samples; s++)
+		{
+			unsigned long long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+			Clock::time_point start = Clock::now();
+			wrapper.Execute(script);
+			JsWrapper::RunEventLoop(wrapper);
+			Clock::time_point end = Clock::now();
+			allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+			double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			totalNs += ns;
+			nsPerCall.push_back(ns / callsPerSample);
+		}
+
+		std::sort(nsPerCall.begin(), nsPerCall.end());
+
+		unsigned long long calls = static_cast<unsigned long long>(callsPerSample) * samples;
+		return Result { szName, calls, totalNs / calls, Percentile(nsPerCall, 0.50), Percentile(nsPerCall, 0.99), static_cast<double>(allocations) / calls };
+	}
+
+	// Time to get a usable wrapper. prepare() runs untimed before each sample.
+	Result MeasureSessionStart(const char* szName, unsigned samples, const std::function<std::unique_ptr<JsWrapper::IJsWrapper>()>& start, const std::function<void()>& prepare)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		std::vector<double> ns;
+		ns.reserve(samples);
+		unsigned long long allocations = 0;
+		double totalNs = 0;
+
+		for (unsigned s = 0; s < samples; s++)
+		{
+			prepare();
+
+			unsigned long long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+			Clock::time_point begin = Clock::now();
+			std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = start();
+			Clock::time_point end = Clock::now();
+			allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+			double sampleNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			totalNs += sampleNs;
+			ns.push_back(sampleNs);
+		}
+
+		std::sort(ns.begin(), ns.end());
+		return Result { szName, samples, totalNs / samples, Percentile(ns, 0.50), Percentile(ns, 0.99), static_cast<double>(allocations) / samples };
+	}
+
+	// Engine-only cost of a runtime with one current context, without any host
+	// setup. session(create) minus this is what CreateInstance adds on top
+	// (global functions, the context cache, the event loop).
+	Result MeasureContextCreation(unsigned samples)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		std::vector<double> ns;
+		ns.reserve(samples);
+		double totalNs = 0;
+
+		for (unsigned s = 0; s < samples; s++)
+		{
+			JsRuntimeHandle runtime;
+			JsContextRef context;
+
+			Clock::time_point begin = Clock::now();
+			bool created = JsCreateRuntime(JsRuntimeAttributeNone, nullptr, &runtime) == JsNoError
+				&& JsCreateContext(runtime, &context) == JsNoError
+				&& JsSetCurrentContext(context) == JsNoError;
+			Clock::time_point end = Clock::now();
+
+			if (!created)
+				throw std::runtime_error("Unable to create a runtime");
+
+			JsSetCurrentContext(JS_INVALID_REFERENCE);
+			JsDisposeRuntime(runtime);
+
+			double sampleNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			totalNs += sampleNs;
+			ns.push_back(sampleNs);
+		}
+
+		std::sort(ns.begin(), ns.end());
+		return Result { "context(raw)", samples, totalNs / samples, Percentile(ns, 0.50), Percentile(ns, 0.99), 0 };
+	}
+
+	// ResetContext with the spare built by RunIdleTasks beforehand (untimed, as
+	// the runtime thread does when idle) and without, where the new context is
+	// created on the spot.
+	Result MeasureContextReset(const char* szName, unsigned samples, bool idleBetween)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<NullConsole>());
+		std::vector<double> ns;
+		ns.reserve(samples);
+		unsigned long long allocations = 0;
+		double totalNs = 0;
+
+		for (unsigned s = 0; s < samples; s++)
+		{
+			// Something for the reset to throw away.
+			pWrapper->Execute(L"var junk = []; for (var i = 0; i < 1000; i++) { junk.push({ i: i }); }");
+			if (idleBetween)
+				pWrapper->RunIdleTasks();
+
+			unsigned long long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+			Clock::time_point begin = Clock::now();
+			pWrapper->ResetContext();
+			Clock::time_point end = Clock::now();
+			allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+			double sampleNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			totalNs += sampleNs;
+			ns.push_back(sampleNs);
+		}
+
+		std::sort(ns.begin(), ns.end());
+		return Result { szName, samples, totalNs / samples, Percentile(ns, 0.50), Percentile(ns, 0.99), static_cast<double>(allocations) / samples };
+	}
+
+	// Throughput of independent CPU-bound scripts as workers are added.
+	void MeasureExecutorScaling(unsigned jobs)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		const std::wstring script = L"var s = 0; for (var i = 0; i < 200000; i++) { s += i % 7; }";
+		unsigned maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+		double singleWorkerRate = 0;
+
+		std::printf("\n%-22s %10s %12s %10s\n", "executor", "workers", "scripts/s", "speedup");
+		std::vector<unsigned> workerCounts;
+		for (unsigned workers = 1; workers < maxWorkers; workers *= 2)
+			workerCounts.push_back(workers);
+		workerCounts.push_back(maxWorkers);
+
+		for (unsigned workers : workerCounts)
+		{
+			JsWrapper::ScriptExecutor executor(workers, [](size_t) { return std::make_unique<NullConsole>(); });
+
+			// Warm every worker's runtime before timing.
+			std::vector<std::future<void>> results;
+			for (unsigned i = 0; i < workers * 2; i++)
+				results.push_back(executor.Submit(script));
+			for (auto& result : results)
+				result.get();
+			results.clear();
+
+			Clock::time_point start = Clock::now();
+			for (unsigned i = 0; i < jobs; i++)
+				results.push_back(executor.Submit(script));
+			for (auto& result : results)
+				result.get();
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			double rate = jobs / seconds;
+			if (workers == 1)
+				singleWorkerRate = rate;
+			std::printf("%-22s %10u %12.1f %10.2f\n", "batch", workers, rate, rate / singleWorkerRate);
+		}
+	}
+
+	// Cost of handing a script to the runtime thread (Submit) and of the full
+	// round trip until its future is ready.
+	void MeasureRuntimeThread(const Options& options)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		JsWrapper::RuntimeThread runtimeThread([]() { return JsWrapper::CreateInstance(std::make_unique<NullConsole>()); });
+		runtimeThread.Submit(L"").get();
+
+		std::vector<double> submitNs;
+		std::vector<double> roundTripNs;
+		unsigned long long allocations = 0;
+		double totalSubmitNs = 0;
+		double totalRoundTripNs = 0;
+		unsigned samples = options.samples * 10;
+
+		for (unsigned s = 0; s < samples; s++)
+		{
+			std::wstring code;
+			unsigned long long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+			Clock::time_point start = Clock::now();
+			std::future<void> result = runtimeThread.Submit(std::move(code));
+			Clock::time_point submitted = Clock::now();
+			allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+			result.get();
+			Clock::time_point done = Clock::now();
+
+			submitNs.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(submitted - start).count()));
+			roundTripNs.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - start).count()));
+			totalSubmitNs += submitNs.back();
+			totalRoundTripNs += roundTripNs.back();
+		}
+
+		std::sort(submitNs.begin(), submitNs.end());
+		std::sort(roundTripNs.begin(), roundTripNs.end());
+		Print(Result { "RuntimeThread submit", samples, totalSubmitNs / samples, Percentile(submitNs, 0.50), Percentile(submitNs, 0.99), static_cast<double>(allocations) / samples }, 0);
+		Print(Result { "RuntimeThread run('')", samples, totalRoundTripNs / samples, Percentile(roundTripNs, 0.50), Percentile(roundTripNs, 0.99), 0 }, 0);
+
+		// Burst from several producers to exercise the queue.
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 4; p++)
+		{
+			producers.emplace_back([&runtimeThread, samples]()
+			{
+				for (unsigned s = 0; s < samples; s++)
+					runtimeThread.Submit(L"0");
+			});
+		}
+		for (auto& producer : producers)
+			producer.join();
+		runtimeThread.Submit(L"").get();
+
+		JsWrapper::RuntimeThread::Stats stats = runtimeThread.GetStats();
+		std::printf("%-22s %10llu completed, max queue depth %zu\n", "RuntimeThread burst", stats.completed, stats.maxDepth);
+	}
+
+	// Stands in for the UI TextBox: every write rebuilds the whole text, like
+	// Text = Text + "\n" + lines does.
+	class TextSink : public JsWrapper::IOutputSink
+	{
+	public:
+		void Write(const std::wstring& lines, size_t lineCount) override
+		{
+			m_text = m_text + L"\n" + lines;
+			m_lines += lineCount;
+		}
+
+		size_t Lines() const { return m_lines; }
+
+	private:
+		std::wstring m_text;
+		size_t m_lines { 0 };
+	};
+
+	// What the app does instead: history goes into a capped OutputStore and only
+	// the newest lines are rebuilt.
+	class StoreSink : public JsWrapper::IOutputSink
+	{
+	public:
+		StoreSink() : m_store(4 * 1024 * 1024) { }
+		void Write(const std::wstring& lines, size_t lineCount) override
+		{
+			m_store.AppendLines(lines.c_str(), lines.length());
+			uint64_t end = m_store.EndLine();
+			m_store.CopyLines(end > 1000 ? end - 1000 : 0, end, m_visible);
+			m_lines += lineCount;
+		}
+
+		size_t Lines() const { return m_lines; }
+
+	private:
+		JsWrapper::OutputStore m_store;
+		std::wstring m_visible;
+		size_t m_lines { 0 };
+	};
+
+	class BufferedConsole : public JsWrapper::IConsole
+	{
+	public:
+		explicit BufferedConsole(JsWrapper::OutputBuffer& output) : m_output(output) { }
+		void Append(JsWrapper::StringView text) override { m_output.Append(text.Data(), text.Length()); }
+		void SetColor(JsWrapper::StringView hexColor) override { }
+		void Rotate(double x, double y, double z) override { }
+
+	private:
+		JsWrapper::OutputBuffer& m_output;
+	};
+
+	// console_log throughput into a TextBox-like sink, written once per line or
+	// once per 16ms frame by a separate "UI" thread, and into an OutputStore.
+	// With pReplayer the calls come from a recorded log instead of the script,
+	// leaving only the output side.
+	template <class TSink>
+	void MeasureOutput(const char* szName, const std::wstring& script, bool perFrame, const JsWrapper::ConsoleReplayer* pReplayer = nullptr)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		TSink* pSink = new TSink();
+		JsWrapper::OutputBuffer::FlushRequest requestFlush;
+		if (perFrame)
+			requestFlush = []() {}; // the frame thread below flushes on its own schedule
+		JsWrapper::OutputBuffer output(std::unique_ptr<JsWrapper::IOutputSink>(pSink), 0, requestFlush);
+
+		std::unique_ptr<JsWrapper::IJsWrapper> pWrapper;
+		if (!pReplayer)
+			pWrapper = JsWrapper::CreateInstance(std::make_unique<BufferedConsole>(output));
+		BufferedConsole replayConsole(output);
+
+		std::atomic<bool> running { true };
+		std::thread frames;
+		if (perFrame)
+		{
+			frames = std::thread([&output, &running]()
+			{
+				while (running.load())
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(16));
+					output.Flush();
+				}
+			});
+		}
+
+		Clock::time_point start = Clock::now();
+		if (pReplayer)
+			pReplayer->Replay(replayConsole, JsWrapper::ConsoleReplayer::Pace::AsFastAsPossible);
+		else
+			pWrapper->Execute(script);
+		running.store(false);
+		if (frames.joinable())
+			frames.join();
+		output.Flush();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::printf("%-22s %10zu %12.0f %10llu\n", szName, pSink->Lines(), pSink->Lines() / seconds, output.GetStats().batches);
+	}
+
+	// The app's path: the runtime thread writes console calls into a CommandRing,
+	// a "UI" thread drains it into the OutputBuffer once per 16ms frame.
+	void MeasureRingOutput(const char* szName, const std::wstring& script)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		StoreSink* pSink = new StoreSink();
+		JsWrapper::OutputBuffer output(std::unique_ptr<JsWrapper::IOutputSink>(pSink), 64 * 1024);
+		auto psCommands = std::make_shared<JsWrapper::CommandRing>(1024 * 1024);
+		std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<JsWrapper::RingConsole>(psCommands));
+
+		std::atomic<bool> running { true };
+		std::thread frames([&output, &running, &psCommands]()
+		{
+			BufferedConsole console(output);
+			while (running.load())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(16));
+				psCommands->Drain(console);
+				output.Flush();
+			}
+			psCommands->Drain(console);
+			output.Flush();
+		});
+
+		Clock::time_point start = Clock::now();
+		pWrapper->Execute(script);
+		running.store(false);
+		frames.join();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		JsWrapper::CommandRing::Stats stats = psCommands->GetStats();
+		std::printf("%-22s %10zu %12.0f %10llu (%llu waits for room)\n", szName, pSink->Lines(), pSink->Lines() / seconds, stats.batches, stats.producerWaits);
+	}
+
+	void MeasureOutput(const Options& options)
+	{
+		const unsigned lines = options.batch * 10;
+		const std::wstring script = L"for (var i = 0; i < " + std::to_wstring(lines) + L"; i++) { console_log('output line ' + i); }";
+
+		std::printf("\n%-22s %10s %12s %10s\n", "output", "lines", "lines/s", "batches");
+		MeasureOutput<TextSink>("per line", script, false);
+		MeasureOutput<TextSink>("per frame", script, true);
+		MeasureOutput<StoreSink>("per frame, store", script, true);
+		MeasureRingOutput("per frame, ring", script);
+
+		// The same calls again from a log, as fast as they can be replayed.
+		std::FILE* pLog = std::tmpfile();
+		if (!pLog)
+			throw std::runtime_error("Unable to create a temporary file");
+		{
+			std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<JsWrapper::ConsoleRecorder>(nullptr, pLog));
+			pWrapper->Execute(script);
+		}
+		std::rewind(pLog);
+		JsWrapper::ConsoleReplayer replayer(pLog);
+		std::fclose(pLog);
+
+		MeasureOutput<StoreSink>("replay, store", script, true, &replayer);
+	}
+
+	// ExecuteProfiled on a CPU-bound script. "debug mode" samples less than once
+	// per run, so it's the cost of running without the JIT; the sampled rows
+	// add the breaks and stack reads on top of that.
+	void MeasureProfiler(const Options& options)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		const std::wstring script = L"function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); } fib(25);";
+		std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<NullConsole>());
+		unsigned runs = std::max(options.samples / 10, 5u);
+
+		// Median milliseconds per run.
+		auto measure = [&](const std::function<void()>& run)
+		{
+			run();
+			std::vector<double> ms;
+			for (unsigned r = 0; r < runs; r++)
+			{
+				Clock::time_point start = Clock::now();
+				run();
+				ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+			}
+			std::sort(ms.begin(), ms.end());
+			return Percentile(ms, 0.5);
+		};
+
+		double plainMs = measure([&]() { pWrapper->Execute(script); });
+		double debugMs = measure([&]()
+		{
+			JsWrapper::SamplingProfile profile(std::chrono::hours(1));
+			pWrapper->ExecuteProfiled(script, profile);
+		});
+
+		std::printf("\n%-22s %10s %10s %12s %10s\n", "profiler", "ms/run", "vs JIT", "vs debug", "samples");
+		std::printf("%-22s %10.2f\n", "Execute", plainMs);
+		std::printf("%-22s %10.2f %9.1f%%\n", "debug mode", debugMs, (debugMs / plainMs - 1) * 100);
+
+		const unsigned intervals[] = { 1000, JsWrapper::SamplingProfile::kDefaultIntervalMicroseconds };
+		for (unsigned interval : intervals)
+		{
+			unsigned long long samples = 0;
+			double sampledMs = measure([&]()
+			{
+				JsWrapper::SamplingProfile profile { std::chrono::microseconds(interval) };
+				pWrapper->ExecuteProfiled(script, profile);
+				samples = profile.Samples();
+			});
+
+			std::string name = "sampled(" + std::to_string(interval / 1000) + "ms)";
+			std::printf("%-22s %10.2f %9.1f%% %11.1f%% %10llu\n", name.c_str(), sampledMs, (sampledMs / plainMs - 1) * 100, (sampledMs / debugMs - 1) * 100, samples);
+		}
+	}
+
+	// A multi-megabyte generated script, read and decoded into a std::wstring
+	// for Execute (what jsexec did), read and passed as is to ExecuteUtf8, and
+	// mapped by ExecuteFile. Host MB is
+	// everything the host allocated for the run, i.e. the copies of the source.
+	// Execute through the bytecode cache runs cold, with the cache file removed
+	// beforehand so it parses and serializes, and warm, from the stored bytecode.
+	void MeasureScriptLoad(const Options& options)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		const char* szPath = "jsexec_bench_load.js";
+		std::string source;
+		for (unsigned i = 0; i < 100000; i++)
+			source += "function f" + std::to_string(i) + "(x) { return x * " + std::to_string(i) + " + 1; }\n";
+
+		std::FILE* pFile = std::fopen(szPath, "wb");
+		if (!pFile)
+			throw std::runtime_error("Unable to create a temporary file");
+		std::fwrite(source.data(), 1, source.length(), pFile);
+		std::fclose(pFile);
+		source = std::string();
+
+		const unsigned runs = std::max(options.samples / 40, 3u);
+		auto measureWith = [&](const char* szName, const JsWrapper::Settings& settings, const std::function<void()>& prepare, const std::function<void(JsWrapper::IJsWrapper&)>& run)
+		{
+			std::vector<double> ms;
+			unsigned long long bytes = 0;
+			size_t engineBytes = 0;
+			JsWrapper::BytecodeCacheStats cache;
+			for (unsigned r = 0; r < runs; r++)
+			{
+				prepare();
+				std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<NullConsole>(), settings);
+
+				unsigned long long bytesBefore = g_allocatedBytes.load(std::memory_order_relaxed);
+				Clock::time_point start = Clock::now();
+				run(*pWrapper);
+				ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+				bytes += g_allocatedBytes.load(std::memory_order_relaxed) - bytesBefore;
+				engineBytes = pWrapper->GetMemoryUsage().current;
+
+				JsWrapper::BytecodeCacheStats runCache = pWrapper->GetBytecodeCacheStats();
+				cache.hits += runCache.hits;
+				cache.misses += runCache.misses;
+			}
+
+			std::sort(ms.begin(), ms.end());
+			std::printf("%-22s %10.2f %10.2f %12.1f", szName, Percentile(ms, 0.5), bytes / 1048576.0 / runs, engineBytes / 1048576.0);
+			if (!settings.bytecodeCacheDirectory.empty())
+				std::printf(" (%llu cache hits, %llu misses)", cache.hits, cache.misses);
+			std::fputc('\n', stdout);
+		};
+		auto measure = [&](const char* szName, const std::function<void(JsWrapper::IJsWrapper&)>& run)
+		{
+			measureWith(szName, JsWrapper::Settings(), []() {}, run);
+		};
+
+		std::printf("\n%-22s %10s %10s %12s\n", "script load", "ms", "host MB", "engine MB");
+		auto readSource = [szPath]()
+		{
+			std::FILE* pSource = std::fopen(szPath, "rb");
+			std::string bytes;
+			char chunk[64 * 1024];
+			size_t read;
+			while (pSource && (read = std::fread(chunk, 1, sizeof(chunk), pSource)) > 0)
+				bytes.append(chunk, read);
+			if (pSource)
+				std::fclose(pSource);
+			return bytes;
+		};
+
+		measure("Execute(read)", [&readSource](JsWrapper::IJsWrapper& wrapper)
+		{
+			std::string bytes = readSource();
+			wrapper.Execute(JsWrapper::Jsrt::DecodeScript(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.length()));
+		});
+		measure("ExecuteUtf8(read)", [&readSource](JsWrapper::IJsWrapper& wrapper) { wrapper.ExecuteUtf8(readSource()); });
+		measure("ExecuteFile(mapped)", [szPath](JsWrapper::IJsWrapper& wrapper)
+		{
+			std::string path(szPath);
+			wrapper.ExecuteFile(JsWrapper::Jsrt::FromUtf8(path.data(), path.length()));
+		});
+
+		// The cache goes in the working directory, next to the script.
+		std::string bytes = readSource();
+		std::wstring cacheFile = JsWrapper::BytecodeCache::FileName(JsWrapper::Jsrt::DecodeScript(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.length()));
+		std::string cachePath = JsWrapper::Jsrt::ToUtf8(cacheFile.c_str(), cacheFile.length());
+		bytes = std::string();
+
+		JsWrapper::Settings cached;
+		cached.bytecodeCacheDirectory = L".";
+		auto executeCached = [&readSource](JsWrapper::IJsWrapper& wrapper)
+		{
+			std::string bytes = readSource();
+			wrapper.Execute(JsWrapper::Jsrt::DecodeScript(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.length()));
+		};
+		measureWith("Execute(cache cold)", cached, [&cachePath]() { std::remove(cachePath.c_str()); }, executeCached);
+		measureWith("Execute(cache warm)", cached, []() {}, executeCached);
+
+		std::remove(cachePath.c_str());
+		std::remove(szPath);
+	}
+
+	// Many small sessions: a runtime each (CreateInstance) against contexts
+	// sharing one (CreateRuntime). Each session runs a little script so its
+	// context is fully built. Memory is the engine's GC heap once all sessions
+	// are up, per session; creation time includes that first script.
+	void MeasureDensity(unsigned sessions)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		const std::wstring script = L"var session = { opened: Date.now(), lines: [] }; session.lines.push('hello');";
+
+		auto measure = [&](const char* szName, const std::function<std::unique_ptr<JsWrapper::IJsWrapper>()>& create, const std::function<size_t(const std::vector<std::unique_ptr<JsWrapper::IJsWrapper>>&)>& heapBytes)
+		{
+			std::vector<std::unique_ptr<JsWrapper::IJsWrapper>> wrappers;
+			wrappers.reserve(sessions);
+
+			Clock::time_point start = Clock::now();
+			for (unsigned i = 0; i < sessions; i++)
+			{
+				wrappers.push_back(create());
+				wrappers.back()->Execute(script);
+			}
+			double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			double kbPerSession = heapBytes(wrappers) / 1024.0 / sessions;
+			std::printf("%-22s %10u %10.1f %12.1f %12.1f\n", szName, sessions, totalMs, totalMs * 1000 / sessions, kbPerSession);
+		};
+
+		std::printf("\n%-22s %10s %10s %12s %12s\n", "density", "sessions", "ms", "us/session", "KB/session");
+
+		measure("runtime per session", []() { return JsWrapper::CreateInstance(std::make_unique<NullConsole>()); },
+			[](const std::vector<std::unique_ptr<JsWrapper::IJsWrapper>>& wrappers)
+		{
+			size_t bytes = 0;
+			for (auto& pWrapper : wrappers)
+				bytes += pWrapper->GetMemoryUsage().current;
+			return bytes;
+		});
+
+		std::shared_ptr<JsWrapper::IJsRuntime> psRuntime = JsWrapper::CreateRuntime();
+		measure("shared runtime", [&psRuntime]() { return psRuntime->CreateWrapper(std::make_unique<NullConsole>()); },
+			[&psRuntime](const std::vector<std::unique_ptr<JsWrapper::IJsWrapper>>&) { return psRuntime->GetMemoryUsage().current; });
+	}
+
+	std::wstring Loop(unsigned count, const wchar_t* wzBody)
+	{
+		return L"for (var i = 0; i < " + std::to_wstring(count) + L"; i++) { " + wzBody + L" }";
+	}
+
+	bool Selected(const Options& options, const char* szName)
+	{
+		return !options.szFilter || std::strstr(szName, options.szFilter);
+	}
+
+	bool ParseArguments(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+				options.samples = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+			else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+				options.batch = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+			else if (argv[i][0] != '-' && !options.szFilter)
+				options.szFilter = argv[i];
+			else
+				return false;
+		}
+		return options.samples > 0 && options.batch > 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		std::fputs("usage: jsexec_bench [--samples N] [--batch N] [name-filter]\n", stderr);
+		return 2;
+	}
+
+	struct BoundaryCase
+	{
+		const char* szName;
+		const wchar_t* wzCall;
+	};
+
+	const BoundaryCase cases[] = {
+		{ "foobar", L"foobar();" },
+		{ "console_log", L"console_log('benchmark line');" },
+		{ "console_log(1k)", L"console_log(longLine);" },
+		{ "set_color", L"set_color('#FF2F00FB');" },
+		{ "set_rotation", L"set_rotation(i / 2, i, -i);" },
+		{ "sleep(0)", L"sleep(0);" },
+	};
+
+	try
+	{
+		std::unique_ptr<JsWrapper::IJsWrapper> pWrapper = JsWrapper::CreateInstance(std::make_unique<NullConsole>());
+
+		// 1024 characters, for the cost that scales with the string rather than the call.
+		pWrapper->Execute(L"var longLine = new Array(1025).join('x');");
+
+		std::printf("%-22s %10s %10s %10s %10s %10s %8s\n", "benchmark", "calls", "ns/call", "net", "p50", "p99", "allocs");
+
+		Result baseline = Measure(*pWrapper, "(empty loop)", Loop(options.batch, L""), options.batch, options.samples);
+		Print(baseline, baseline.meanNs);
+
+		for (auto& boundaryCase : cases)
+		{
+			if (Selected(options, boundaryCase.szName))
+				Print(Measure(*pWrapper, boundaryCase.szName, Loop(options.batch, boundaryCase.wzCall), options.batch, options.samples), baseline.meanNs);
+		}
+
+		// The README animation, 720 steps of a set_rotation and a set_color call,
+		// against handing the same track to play_timeline. Its times are all 0
+		// here so it's done in the one call: that row is the handoff and a frame.
+		if (Selected(options, "animation"))
+		{
+			pWrapper->Execute(L"var track = new Float64Array(720 * 5); for (var k = 0; k < 720; k++) { var x = k - 360; track.set([0, x / 2, x, -x, 0xFFFB2F00 + x], k * 5); }");
+			Print(Measure(*pWrapper, "animation(calls)", L"for (var x = -360; x < 360; x++) { set_rotation(x / 2, x, -x); set_color((0xFFFB2F00 + x).toString(16)); }", 1, options.samples), 0);
+			Print(Measure(*pWrapper, "animation(timeline)", L"play_timeline(track);", 1, options.samples), 0);
+		}
+
+		// The same calls into a console that takes UTF-8.
+		if (Selected(options, "console_log(utf8)"))
+		{
+			std::unique_ptr<JsWrapper::IJsWrapper> pUtf8Wrapper = JsWrapper::CreateInstance(std::make_unique<NullUtf8Console>());
+			pUtf8Wrapper->Execute(L"var longLine = new Array(1025).join('x');");
+			Print(Measure(*pUtf8Wrapper, "console_log(utf8)", Loop(options.batch, L"console_log('benchmark line');"), options.batch, options.samples), baseline.meanNs);
+			Print(Measure(*pUtf8Wrapper, "console_log(1k, utf8)", Loop(options.batch, L"console_log(longLine);"), options.batch, options.samples), baseline.meanNs);
+		}
+
+		// Fixed cost of Execute itself: one call per sample.
+		if (Selected(options, "Execute"))
+		{
+			Print(Measure(*pWrapper, "Execute('')", L"", 1, options.samples * 10), 0);
+			Print(Measure(*pWrapper, "Execute('0')", L"0", 1, options.samples * 10), 0);
+		}
+
+		// Session start: building a wrapper on demand vs taking a pre-warmed one.
+		if (Selected(options, "session"))
+		{
+			unsigned sessions = std::max(options.samples / 10, 10u);
+			Result rawContext = MeasureContextCreation(sessions);
+			Print(rawContext, 0);
+			Print(MeasureSessionStart("session(create)", sessions, []() { return JsWrapper::CreateInstance(std::make_unique<NullConsole>()); }, []() {}), rawContext.meanNs);
+
+			JsWrapper::WrapperPool pool(1, []() { return std::make_unique<NullConsole>(); });
+			Print(MeasureSessionStart("session(pool)", sessions, [&pool]() { return pool.Acquire(); }, [&pool]()
+			{
+				while (pool.GetStats().ready == 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}), 0);
+
+			Print(MeasureContextReset("reset(spare)", sessions, true), 0);
+			Print(MeasureContextReset("reset(cold)", sessions, false), 0);
+		}
+
+		if (Selected(options, "RuntimeThread"))
+			MeasureRuntimeThread(options);
+
+		if (Selected(options, "output"))
+			MeasureOutput(options);
+
+		if (Selected(options, "executor"))
+			MeasureExecutorScaling(std::max(options.samples, 64u));
+
+		if (Selected(options, "profiler"))
+			MeasureProfiler(options);
+
+		if (Selected(options, "script load"))
+			MeasureScriptLoad(options);
+
+		if (Selected(options, "density"))
+			MeasureDensity(std::max(options.samples / 2, 10u));
+	}
+	catch (JsWrapper::Exception::Script& scriptException)
+	{
+		std::string why = JsWrapper::Jsrt::ToUtf8(scriptException.why().c_str(), scriptException.why().length());
+		std::fprintf(stderr, "jsexec_bench: Exception:\n%s\n", why.c_str());
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		std::fprintf(stderr, "jsexec_bench: %s\n", e.what());
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "StreamConsole.h"
+#include "JsrtCompat.h"
+
+#include <stdexcept>
+
+namespace JsWrapper
+{
+
+StreamConsole::StreamConsole(std::FILE* pStream, bool echoState) : StreamConsole(pStream, echoState, false) { }
+
+StreamConsole::StreamConsole(std::FILE* pStream, bool echoState, bool ownsStream) : m_pStream(pStream), m_echoState(echoState), m_ownsStream(ownsStream) { }
+
+std::unique_ptr<StreamConsole> StreamConsole::OpenFile(const std::string& path, bool echoState)
+{
+	std::FILE* pStream = std::fopen(path.c_str(), "wb");
+	if (!pStream)
+		throw std::runtime_error("Unable to open console output: " + path);
+
+	return std::unique_ptr<StreamConsole>(new StreamConsole(pStream, echoState, true));
+}
+
+StreamConsole::~StreamConsole()
+{
+	if (m_ownsStream)
+		std::fclose(m_pStream);
+	else
+		std::fflush(m_pStream);
+}
+
+void StreamConsole::Append(StringView text)
+{
+	m_line.clear();
+	Jsrt::AppendUtf8(text.Data(), text.Length(), m_line);
+	m_line.push_back('\n');
+	std::fwrite(m_line.data(), 1, m_line.length(), m_pStream);
+}
+
+void StreamConsole::AppendUtf8(Utf8View text)
+{
+	m_line.assign(text.Data(), text.Length());
+	m_line.push_back('\n');
+	std::fwrite(m_line.data(), 1, m_line.length(), m_pStream);
+}
+
+void StreamConsole::SetColor(StringView hexColor)
+{
+	if (!m_echoState)
+		return;
+
+	m_line.assign("#color ");
+	Jsrt::AppendUtf8(hexColor.Data(), hexColor.Length(), m_line);
+	m_line.push_back('\n');
+	std::fwrite(m_line.data(), 1, m_line.length(), m_pStream);
+}
+
+void StreamConsole::Rotate(double x, double y, double z)
+{
+	if (!m_echoState)
+		return;
+
+	std::fprintf(m_pStream, "#rotate %g %g %g\n", x, y, z);
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// IConsole for hosts without a UI. Appended text is written to a stdio stream as UTF-8,
+// one line per call. Color and rotation changes are dropped unless echoState is set,
+// in which case they are written as "#color ..." and "#rotate x y z" lines.
+class StreamConsole : public IConsole
+{
+public:
+	// Does not take ownership of pStream.
+	StreamConsole(std::FILE* pStream, bool echoState = false);
+
+	// Opens (truncates) path. Throws std::runtime_error if the file can't be opened.
+	static std::unique_ptr<StreamConsole> OpenFile(const std::string& path, bool echoState = false);
+
+	~StreamConsole();
+
+	void Append(StringView text) override;
+	void SetColor(StringView hexColor) override;
+	void Rotate(double x, double y, double z) override;
+
+	// The stream is UTF-8, console_log text is written as is.
+	bool WantsUtf8() const override { return true; }
+	void AppendUtf8(Utf8View text) override;
+
+private:
+	StreamConsole(std::FILE* pStream, bool echoState, bool ownsStream);
+
+	std::FILE* m_pStream;
+	bool m_echoState;
+	bool m_ownsStream;
+	std::string m_line; // reused for each line, written with a single fwrite
+};
+
+}
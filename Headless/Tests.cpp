@@ -0,0 +1,526 @@
+//
+// Tests.cpp
+// jsexec_tests: behaviour checks for the host-side pieces that work without a
+// script engine: console history, latency histograms, console logs, the
+// command ring and keyframe timelines. Run by ctest.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CallStats.h"
+#include "CommandRing.h"
+#include "ConsoleRecorder.h"
+#include "JsWrapper.h"
+#include "OutputStore.h"
+#include "Timeline.h"
+#include "Tracer.h"
+
+namespace
+{
+	int g_failures = 0;
+
+	void Check(bool condition, const char* szCondition, const char* szFile, int line)
+	{
+		if (condition)
+			return;
+
+		std::fprintf(stderr, "%s(%d): check failed: %s\n", szFile, line, szCondition);
+		g_failures++;
+	}
+
+	bool Throws(const std::function<void()>& call)
+	{
+		try
+		{
+			call();
+		}
+		catch (std::exception&)
+		{
+			return true;
+		}
+		return false;
+	}
+}
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+namespace
+{
+	using namespace JsWrapper;
+
+	// Keeps every console call it gets, text copied out of the caller's buffer.
+	class CallLog : public IConsole
+	{
+	public:
+		struct Call
+		{
+			char kind; // 'a'ppend, 'c'olor, 'r'otate or 'x' for a ring clear
+			std::wstring text;
+			double x, y, z;
+		};
+
+		void Append(StringView text) override { m_calls.push_back(Call { 'a', std::wstring(text.Data(), text.Length()), 0, 0, 0 }); }
+		void SetColor(StringView hexColor) override { m_calls.push_back(Call { 'c', std::wstring(hexColor.Data(), hexColor.Length()), 0, 0, 0 }); }
+		void Rotate(double x, double y, double z) override { m_calls.push_back(Call { 'r', std::wstring(), x, y, z }); }
+		void Clear() { m_calls.push_back(Call { 'x', std::wstring(), 0, 0, 0 }); }
+
+		const std::vector<Call>& Calls() const { return m_calls; }
+
+	private:
+		std::vector<Call> m_calls;
+	};
+
+	std::wstring Lines(const OutputStore& store, uint64_t first, uint64_t end)
+	{
+		std::wstring text;
+		store.CopyLines(first, end, text);
+		return text;
+	}
+
+	void TestOutputStore()
+	{
+		OutputStore store(1024 * 1024, 4);
+		std::wstring lines(L"one\ntwo\n\nfour");
+		store.AppendLines(lines.c_str(), lines.length());
+
+		CHECK(store.FirstLine() == 0);
+		CHECK(store.EndLine() == 4);
+		CHECK(Lines(store, 0, 4) == L"one\ntwo\n\nfour");
+		CHECK(Lines(store, 1, 2) == L"two");
+		CHECK(Lines(store, 2, 3) == L"");
+		CHECK(Lines(store, 3, 100) == L"four");
+
+		// Offsets count the characters of the lines, without separators.
+		CHECK(store.LineAt(0) == 0);
+		CHECK(store.LineAt(2) == 0);
+		CHECK(store.LineAt(3) == 1);
+		CHECK(store.LineAt(6) == 3); // the empty line shares its offset with the next
+		CHECK(store.LineAt(1000) == 3);
+
+		// Line numbers keep counting across a clear.
+		store.Clear();
+		CHECK(store.FirstLine() == 4);
+		CHECK(store.EndLine() == 4);
+		CHECK(Lines(store, 0, 4) == L"");
+		store.AppendLine(L"five", 4);
+		CHECK(Lines(store, 4, 5) == L"five");
+		CHECK(store.LineAt(0) == 4);
+	}
+
+	void TestOutputStoreTrim()
+	{
+		const size_t capacity = 256;
+		OutputStore store(capacity, 8);
+
+		for (int i = 0; i < 200; i++)
+		{
+			std::wstring line = L"line " + std::to_wstring(i);
+			store.AppendLine(line.c_str(), line.length());
+			CHECK(store.Bytes() <= capacity);
+		}
+
+		// The oldest lines are gone, what's left is whole and in order.
+		CHECK(store.EndLine() == 200);
+		CHECK(store.FirstLine() > 0);
+		CHECK(store.FirstLine() < 199);
+		for (uint64_t line = store.FirstLine(); line < store.EndLine(); line++)
+			CHECK(Lines(store, line, line + 1) == L"line " + std::to_wstring(line));
+		CHECK(Lines(store, 0, store.FirstLine()) == L"");
+		CHECK(store.LineAt(0) == store.FirstLine());
+
+		// A line longer than the cap keeps only the chunk being written to.
+		std::wstring longLine(1000, L'x');
+		store.AppendLine(longLine.c_str(), longLine.length());
+		CHECK(store.Bytes() <= capacity);
+		CHECK(store.FirstLine() == store.EndLine());
+	}
+
+	void TestLatencyHistogram()
+	{
+		LatencyHistogram empty;
+		CHECK(empty.Count() == 0);
+		CHECK(empty.ValueAtQuantile(0.5) == 0);
+
+		// Small values are exact.
+		LatencyHistogram small;
+		for (uint64_t value : { 5, 5, 5, 7 })
+			small.Record(value);
+		CHECK(small.Count() == 4);
+		CHECK(small.Total() == 22);
+		CHECK(small.ValueAtQuantile(0.5) == 5);
+		CHECK(small.ValueAtQuantile(1.0) == 7);
+		CHECK(small.ValueAtQuantile(0.0) == 5);
+
+		// Larger ones are within 1/16 of the exact percentile.
+		LatencyHistogram histogram;
+		for (uint64_t value = 1; value <= 10000; value++)
+			histogram.Record(value * 1000);
+		auto close = [](uint64_t value, uint64_t exact) { return value * 16 >= exact * 15 && value * 16 <= exact * 17; };
+		CHECK(histogram.Count() == 10000);
+		CHECK(close(histogram.ValueAtQuantile(0.5), 5000000));
+		CHECK(close(histogram.ValueAtQuantile(0.9), 9000000));
+		CHECK(close(histogram.ValueAtQuantile(0.99), 9900000));
+		CHECK(histogram.ValueAtQuantile(1.0) <= histogram.Max());
+		CHECK(histogram.Max() == 10000000);
+
+		// Past the last bucket only the maximum stays exact.
+		LatencyHistogram huge;
+		huge.Record(uint64_t(1) << 40);
+		CHECK(huge.Max() == uint64_t(1) << 40);
+		CHECK(huge.ValueAtQuantile(1.0) <= huge.Max());
+		CHECK(huge.ValueAtQuantile(1.0) >= uint64_t(1) << 35);
+	}
+
+	void TestConsoleLogRoundTrip()
+	{
+		std::FILE* pLog = std::tmpfile();
+		CHECK(pLog != nullptr);
+		if (!pLog)
+			return;
+
+		std::unique_ptr<CallLog> psInner = std::make_unique<CallLog>();
+		CallLog* pInner = psInner.get();
+		{
+			ConsoleRecorder recorder(std::move(psInner), pLog);
+			CHECK(!recorder.WantsUtf8()); // as the wide-only console it wraps
+			recorder.Append(StringView(L"plain"));
+			recorder.Append(StringView(L"café ☃"));
+			recorder.AppendUtf8(Utf8View("utf-8 \xe2\x82\xac"));
+			recorder.SetColor(StringView(L"#FF00FF00"));
+			recorder.Rotate(1.5, -2.25, 360);
+			recorder.Append(StringView(L""));
+
+			// Forwarded as they came.
+			CHECK(pInner->Calls().size() == 6);
+		}
+
+		std::rewind(pLog);
+		ConsoleReplayer replayer(pLog);
+		std::fclose(pLog);
+
+		CallLog replayed;
+		ConsoleReplayer::Stats stats = replayer.Replay(replayed, ConsoleReplayer::Pace::AsFastAsPossible);
+		const std::vector<CallLog::Call>& calls = replayed.Calls();
+
+		CHECK(replayer.CallCount() == 6);
+		CHECK(stats.calls == 6);
+		CHECK(calls.size() == 6);
+		if (calls.size() != 6)
+			return;
+
+		CHECK(calls[0].kind == 'a' && calls[0].text == L"plain");
+		CHECK(calls[1].kind == 'a' && calls[1].text == L"café ☃");
+		CHECK(calls[2].kind == 'a' && calls[2].text == L"utf-8 €");
+		CHECK(calls[3].kind == 'c' && calls[3].text == L"#FF00FF00");
+		CHECK(calls[4].kind == 'r' && calls[4].x == 1.5 && calls[4].y == -2.25 && calls[4].z == 360);
+		CHECK(calls[5].kind == 'a' && calls[5].text.empty());
+	}
+
+	void TestConsoleRecorderWithoutInner()
+	{
+		std::FILE* pLog = std::tmpfile();
+		CHECK(pLog != nullptr);
+		if (!pLog)
+			return;
+
+		{
+			ConsoleRecorder recorder(nullptr, pLog);
+			CHECK(recorder.WantsUtf8());
+			recorder.AppendUtf8(Utf8View("only logged"));
+		}
+
+		std::rewind(pLog);
+		ConsoleReplayer replayer(pLog);
+		std::fclose(pLog);
+
+		CallLog replayed;
+		replayer.Replay(replayed, ConsoleReplayer::Pace::AsFastAsPossible);
+		CHECK(replayed.Calls().size() == 1 && replayed.Calls()[0].text == L"only logged");
+	}
+
+	void TestConsoleLogRejectsOtherFiles()
+	{
+		std::FILE* pFile = std::tmpfile();
+		CHECK(pFile != nullptr);
+		if (!pFile)
+			return;
+
+		std::fputs("not a console log", pFile);
+		std::rewind(pFile);
+		CHECK(Throws([pFile]() { ConsoleReplayer replayer(pFile); }));
+		std::fclose(pFile);
+	}
+
+	size_t DrainInto(CommandRing& ring, CallLog& log)
+	{
+		return ring.Drain(log, [&log]() { log.Clear(); });
+	}
+
+	void TestCommandRingWraparound()
+	{
+		// Odd record sizes, so records end up at every offset and some need a pad.
+		CommandRing ring(4096);
+		CallLog log;
+		size_t calls = 0;
+		for (int i = 0; i < 2000; i++)
+		{
+			ring.Append(StringView(std::wstring(i % 37, static_cast<wchar_t>(L'a' + i % 26))));
+			if (i % 5 == 0)
+				ring.Rotate(i, -i, 0.5);
+			if (i % 7 == 0)
+				calls += DrainInto(ring, log);
+		}
+		calls += DrainInto(ring, log);
+
+		CHECK(calls == log.Calls().size());
+		CHECK(DrainInto(ring, log) == 0);
+
+		size_t index = 0;
+		bool inOrder = true;
+		for (int i = 0; i < 2000 && inOrder; i++)
+		{
+			const CallLog::Call& append = log.Calls()[index++];
+			inOrder = append.kind == 'a' && append.text == std::wstring(i % 37, static_cast<wchar_t>(L'a' + i % 26));
+			if (i % 5 == 0)
+			{
+				const CallLog::Call& rotate = log.Calls()[index++];
+				inOrder = inOrder && rotate.kind == 'r' && rotate.x == i && rotate.y == -i && rotate.z == 0.5;
+			}
+		}
+		CHECK(inOrder);
+		CHECK(index == log.Calls().size());
+
+		CommandRing::Stats stats = ring.GetStats();
+		CHECK(stats.records == log.Calls().size());
+	}
+
+	void TestCommandRingSplitText()
+	{
+		// Longer than the whole ring, so the producer has to wait for the consumer.
+		std::shared_ptr<CommandRing> psRing = std::make_shared<CommandRing>(4096);
+		std::wstring text;
+		for (int i = 0; i < 10000; i++)
+			text += static_cast<wchar_t>(L'A' + i % 50);
+
+		CallLog log;
+		std::thread consumer([&psRing, &log]()
+		{
+			while (log.Calls().size() < 3)
+			{
+				DrainInto(*psRing, log);
+				std::this_thread::yield();
+			}
+		});
+
+		RingConsole console(psRing);
+		console.Append(StringView(text));
+		console.SetColor(StringView(text.substr(0, 3000)));
+		console.Append(StringView(L"after"));
+		consumer.join();
+
+		CHECK(log.Calls().size() == 3);
+		if (log.Calls().size() != 3)
+			return;
+		CHECK(log.Calls()[0].kind == 'a' && log.Calls()[0].text == text);
+		CHECK(log.Calls()[1].kind == 'c' && log.Calls()[1].text == text.substr(0, 3000));
+		CHECK(log.Calls()[2].kind == 'a' && log.Calls()[2].text == L"after");
+		CHECK(psRing->GetStats().producerWaits > 0);
+	}
+
+	void TestCommandRingClear()
+	{
+		CommandRing ring(4096);
+		ring.Append(StringView(L"before"));
+		ring.SetColor(StringView(L"#FF000000"));
+		ring.Clear();
+		ring.Append(StringView(L"after"));
+
+		CallLog log;
+		CHECK(DrainInto(ring, log) == 4);
+		CHECK(log.Calls().size() == 4);
+		if (log.Calls().size() == 4)
+		{
+			CHECK(log.Calls()[2].kind == 'x');
+			CHECK(log.Calls()[3].text == L"after");
+		}
+
+		// Without a handler a clear is skipped.
+		ring.Clear();
+		CallLog ignoring;
+		ring.Drain(ignoring);
+		CHECK(ignoring.Calls().empty());
+	}
+
+	void TestCommandRingClosed()
+	{
+		// No consumer at all: once closed, what doesn't fit is dropped instead of waited for.
+		CommandRing ring(4096);
+		ring.Close();
+		std::wstring line(100, L'x');
+		for (int i = 0; i < 100; i++)
+			ring.Append(StringView(line));
+		ring.Append(StringView(std::wstring(10000, L'y')));
+
+		CallLog log;
+		DrainInto(ring, log);
+		CHECK(!log.Calls().empty());
+		CHECK(log.Calls().size() < 100);
+		bool whole = true;
+		for (const CallLog::Call& call : log.Calls())
+			whole = whole && call.text == line;
+		CHECK(whole);
+	}
+
+	void TestCommandRingCancelWait()
+	{
+		// No consumer: each CancelWait drops the line the producer is waiting to write.
+		CommandRing ring(4096);
+		std::wstring line(100, L'x');
+		std::atomic<bool> done { false };
+		std::thread producer([&ring, &line, &done]()
+		{
+			for (int i = 0; i < 100; i++)
+				ring.Append(StringView(line));
+			done = true;
+		});
+
+		while (!done)
+		{
+			ring.CancelWait();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		producer.join();
+
+		CallLog log;
+		DrainInto(ring, log);
+		CHECK(!log.Calls().empty());
+		CHECK(log.Calls().size() < 100);
+		CHECK(ring.GetStats().producerWaits > 0);
+	}
+
+	void TestTimelineValidate()
+	{
+		const double valid[] = { 0, 0, 0, 0, 0xFF000000, 100, 90, 0, 0, 0xFFFFFFFF, 100, 0, 0, 0, 0 };
+		CHECK(!Throws([&valid]() { Timeline::Validate(valid, 15); }));
+		CHECK(!Throws([&valid]() { Timeline::Validate(valid, 5); }));
+
+		CHECK(Throws([&valid]() { Timeline::Validate(valid, 0); }));
+		CHECK(Throws([&valid]() { Timeline::Validate(valid, 4); }));
+		CHECK(Throws([&valid]() { Timeline::Validate(valid, 12); }));
+
+		const double backwards[] = { 100, 0, 0, 0, 0, 50, 0, 0, 0, 0 };
+		CHECK(Throws([&backwards]() { Timeline::Validate(backwards, 10); }));
+
+		const double negative[] = { -1, 0, 0, 0, 0 };
+		CHECK(Throws([&negative]() { Timeline::Validate(negative, 5); }));
+
+		const double notANumber[] = { std::nan(""), 0, 0, 0, 0 };
+		CHECK(Throws([&notANumber]() { Timeline::Validate(notANumber, 5); }));
+
+		const double endless[] = { 0, 0, 0, 0, 0, HUGE_VAL, 0, 0, 0, 0 };
+		CHECK(Throws([&endless]() { Timeline::Validate(endless, 10); }));
+
+		const double wideColor[] = { 0, 0, 0, 0, 4294967296.0 };
+		CHECK(Throws([&wideColor]() { Timeline::Validate(wideColor, 5); }));
+
+		const double negativeColor[] = { 0, 0, 0, 0, -1 };
+		CHECK(Throws([&negativeColor]() { Timeline::Validate(negativeColor, 5); }));
+	}
+
+	void TestTimelineAt()
+	{
+		const double values[] = {
+			100, 0, 0, 0, 0xFF000000,
+			200, 90, -90, 10, 0xFF0000FF,
+			200, 0, 0, 0, 0x00FFFFFF, // same time: a jump
+			300, 0, 0, 0, 0x00FFFFFF };
+		Timeline timeline(values, 20);
+		CHECK(timeline.LengthMs() == 300);
+
+		// Before the first keyframe it holds still.
+		Timeline::Frame frame = timeline.At(0);
+		CHECK(frame.x == 0 && frame.y == 0 && frame.z == 0 && frame.color == 0xFF000000);
+
+		frame = timeline.At(150);
+		CHECK(frame.x == 45 && frame.y == -45 && frame.z == 5);
+		CHECK(frame.color == 0xFF000080);
+
+		// At a repeated time the later keyframe wins.
+		frame = timeline.At(200);
+		CHECK(frame.x == 0 && frame.color == 0x00FFFFFF);
+
+		frame = timeline.At(1000);
+		CHECK(frame.x == 0 && frame.color == 0x00FFFFFF);
+
+		Timeline single(values, 5);
+		CHECK(single.LengthMs() == 100);
+		frame = single.At(500);
+		CHECK(frame.color == 0xFF000000);
+
+		Timeline empty(values, 4);
+		CHECK(empty.LengthMs() == 0);
+		frame = empty.At(10);
+		CHECK(frame.x == 0 && frame.color == 0);
+
+		wchar_t wzColor[10];
+		Timeline::FormatColor(0x80FF0A1B, wzColor);
+		CHECK(std::wstring(wzColor) == L"#80FF0A1B");
+	}
+
+	void TestTracerReusesBuffers()
+	{
+		// Threads one after another share one buffer, the newest one's events win.
+		Tracer::Start();
+		const wchar_t* names[] = { L"first thread", L"middle thread", L"last thread" };
+		for (int i = 0; i < 50; i++)
+		{
+			const wchar_t* wzName = names[i == 0 ? 0 : (i == 49 ? 2 : 1)];
+			std::thread([wzName]()
+			{
+				Tracer::SetThreadName("traced");
+				Tracer::Complete("test", wzName, Tracer::Clock::now(), Tracer::Clock::now());
+			}).join();
+		}
+		Tracer::Stop();
+
+		std::string json = Tracer::ToJson();
+		CHECK(json.find("last thread") != std::string::npos);
+		CHECK(json.find("first thread") == std::string::npos);
+		CHECK(json.find("middle thread") == std::string::npos);
+	}
+}
+
+int main()
+{
+	TestOutputStore();
+	TestOutputStoreTrim();
+	TestLatencyHistogram();
+	TestConsoleLogRoundTrip();
+	TestConsoleRecorderWithoutInner();
+	TestConsoleLogRejectsOtherFiles();
+	TestCommandRingWraparound();
+	TestCommandRingSplitText();
+	TestCommandRingClear();
+	TestCommandRingClosed();
+	TestCommandRingCancelWait();
+	TestTimelineValidate();
+	TestTimelineAt();
+	TestTracerReusesBuffers();
+
+	if (g_failures > 0)
+	{
+		std::fprintf(stderr, "%d check(s) failed\n", g_failures);
+		return 1;
+	}
+
+	std::printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,392 @@
+//
+// main.cpp
+// jsexec: runs scripts through JsWrapper without the UWP front end.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "CallStats.h"
+#include "ConsoleRecorder.h"
+#include "JsWrapper.h"
+#include "JsrtCompat.h"
+#include "SamplingProfiler.h"
+#include "ScriptExecutor.h"
+#include "StreamConsole.h"
+#include "Tracer.h"
+
+namespace
+{
+	struct Script
+	{
+		std::string name;
+		std::string source; // UTF-8, not read for a file run through ExecuteFile
+		bool file;
+	};
+
+	struct Options
+	{
+		std::vector<Script> scripts;
+		std::string outputPath;
+		std::string cacheDirectory;
+		std::string statsPath;
+		std::string tracePath;
+		std::string profilePath;
+		std::string recordPath;
+		std::string replayPath;
+		size_t workers { 0 }; // 0: run scripts in order in one context
+		size_t memoryLimit { 0 };
+		size_t recycleAfterBytes { 0 };
+		unsigned long timeoutMilliseconds { 0 };
+		bool echoState { false };
+		bool memoryStats { false };
+		bool realTime { false };
+	};
+
+	void PrintUsage()
+	{
+		std::fputs(
+			"usage: jsexec [options] [script.js ...]\n"
+			"  -e <code>            run <code> (may be repeated)\n"
+			"  -o <file>            write console output to <file> instead of stdout\n"
+			"  --cache <dir>        keep serialized bytecode in <dir> across runs\n"
+			"  -j <n>               run each script as an independent job on <n> threads\n"
+			"  --echo-state         also print set_color and set_rotation calls\n"
+			"  --memory-limit <mb>  cap each runtime at <mb> megabytes\n"
+			"  --memory-stats       print memory use (and bytecode cache hits) to stderr after each script\n"
+			"  --recycle <mb>       start a fresh context once the runtime grew by <mb> megabytes\n"
+			"  --stats <file>       write call counts and latencies in Prometheus text format (not with -j)\n"
+			"  --profile <file>     sample JS stacks every 5ms, write folded stacks for flamegraphs (not with -j)\n"
+			"  --trace <file>       write a Chrome trace-event JSON of script, host calls and flushes\n"
+			"  --record <file>      also log every console call with its time to <file> (not with -j)\n"
+			"  --replay <file>      print a log made with --record instead of running scripts\n"
+			"  --realtime           replay with the recorded timing rather than as fast as possible\n"
+			"  --timeout <ms>       stop a script, or a round of its timers, after <ms> milliseconds\n"
+			"  -h, --help           show this message\n"
+			"Scripts run in order in one context, jsexec exits once no timers are pending.\n"
+			"With no scripts, source is read from stdin.\n"
+			"Exits with 1 if a script throws or leaves a promise rejection unhandled,\n"
+			"3 if one times out.\n",
+			stderr);
+	}
+
+	std::string ReadAll(std::istream& stream)
+	{
+		return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	}
+
+	std::string ReadFile(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			throw std::runtime_error("Unable to read " + path);
+
+		return ReadAll(file);
+	}
+
+	bool IsEmptyFile(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			throw std::runtime_error("Unable to read " + path);
+		return file.tellg() == 0;
+	}
+
+	// File scripts are mapped by the wrapper rather than read, unless their
+	// source is needed here.
+	std::wstring CodeOf(const Script& script)
+	{
+		if (!script.file)
+			return JsWrapper::Jsrt::FromUtf8(script.source.data(), script.source.length());
+
+		// Also skips a UTF-8 byte order mark, the UWP project saves sources with one.
+		std::string bytes = ReadFile(script.name);
+		return JsWrapper::Jsrt::DecodeScript(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.length());
+	}
+
+	bool ParseArguments(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char* szArg = argv[i];
+			if (std::strcmp(szArg, "-e") == 0 && i + 1 < argc)
+				options.scripts.push_back(Script { "-e", argv[++i], false });
+			else if (std::strcmp(szArg, "-o") == 0 && i + 1 < argc)
+				options.outputPath = argv[++i];
+			else if (std::strcmp(szArg, "--cache") == 0 && i + 1 < argc)
+				options.cacheDirectory = argv[++i];
+			else if (std::strcmp(szArg, "-j") == 0 && i + 1 < argc)
+				options.workers = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+			else if (std::strcmp(szArg, "--echo-state") == 0)
+				options.echoState = true;
+			else if (std::strcmp(szArg, "--memory-limit") == 0 && i + 1 < argc)
+				options.memoryLimit = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10)) * 1024 * 1024;
+			else if (std::strcmp(szArg, "--recycle") == 0 && i + 1 < argc)
+				options.recycleAfterBytes = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10)) * 1024 * 1024;
+			else if (std::strcmp(szArg, "--memory-stats") == 0)
+				options.memoryStats = true;
+			else if (std::strcmp(szArg, "--stats") == 0 && i + 1 < argc)
+				options.statsPath = argv[++i];
+			else if (std::strcmp(szArg, "--profile") == 0 && i + 1 < argc)
+				options.profilePath = argv[++i];
+			else if (std::strcmp(szArg, "--trace") == 0 && i + 1 < argc)
+				options.tracePath = argv[++i];
+			else if (std::strcmp(szArg, "--record") == 0 && i + 1 < argc)
+				options.recordPath = argv[++i];
+			else if (std::strcmp(szArg, "--replay") == 0 && i + 1 < argc)
+				options.replayPath = argv[++i];
+			else if (std::strcmp(szArg, "--realtime") == 0)
+				options.realTime = true;
+			else if (std::strcmp(szArg, "--timeout") == 0 && i + 1 < argc)
+				options.timeoutMilliseconds = std::strtoul(argv[++i], nullptr, 10);
+			else if (std::strcmp(szArg, "-h") == 0 || std::strcmp(szArg, "--help") == 0)
+				return false;
+			else if (szArg[0] == '-' && szArg[1] != '\0')
+				return false;
+			else
+				options.scripts.push_back(Script { szArg, "", !IsEmptyFile(szArg) });
+		}
+
+		// Each of these belongs to a single wrapper, the workers have one each.
+		if (options.workers && (!options.statsPath.empty() || !options.profilePath.empty() || !options.recordPath.empty()))
+		{
+			std::fprintf(stderr, "-j can't be combined with --stats, --profile or --record\n");
+			return false;
+		}
+
+		if (options.scripts.empty() && options.replayPath.empty())
+			options.scripts.push_back(Script { "<stdin>", ReadAll(std::cin), false });
+
+		return true;
+	}
+
+	// Returns the exit status for it.
+	int ReportException(const std::string& scriptName, JsWrapper::Exception::Script& scriptException)
+	{
+		std::string why = JsWrapper::Jsrt::ToUtf8(scriptException.why().c_str(), scriptException.why().length());
+		std::fprintf(stderr, "%s: Exception:\n%s\n", scriptName.c_str(), why.c_str());
+
+		return dynamic_cast<JsWrapper::Exception::Timeout*>(&scriptException) ? 3 : 1;
+	}
+
+	void ReportMemory(const std::string& scriptName, const JsWrapper::IJsWrapper& wrapper)
+	{
+		JsWrapper::MemoryUsage usage = wrapper.GetMemoryUsage();
+		std::fprintf(stderr, "%s: memory %zu KB, peak %zu KB (this script %zu KB)", scriptName.c_str(), usage.current / 1024, usage.peak / 1024, usage.executePeak / 1024);
+		if (usage.limit != 0)
+			std::fprintf(stderr, ", limit %zu KB, %llu allocations refused", usage.limit / 1024, usage.failedAllocations);
+		if (usage.contextResets != 0)
+			std::fprintf(stderr, ", %llu fresh contexts", usage.contextResets);
+
+		JsWrapper::BytecodeCacheStats cache = wrapper.GetBytecodeCacheStats();
+		if (cache.hits + cache.misses != 0)
+			std::fprintf(stderr, ", bytecode cache %llu hits, %llu misses, %llu rejected", cache.hits, cache.misses, cache.rejected);
+		std::fputc('\n', stderr);
+	}
+
+	void WriteFile(const std::string& path, const std::string& text)
+	{
+		std::FILE* pFile = std::fopen(path.c_str(), "wb");
+		if (!pFile)
+			throw std::runtime_error("Unable to open " + path);
+		std::fwrite(text.data(), 1, text.length(), pFile);
+		std::fclose(pFile);
+	}
+
+	// Like the app: every script runs in the same context, stop at the first exception.
+	int RunScriptsAndTimers(const Options& options, JsWrapper::IJsWrapper& wrapper)
+	{
+		using namespace JsWrapper;
+
+		for (auto& script : options.scripts)
+		{
+			try
+			{
+				// Mapped or handed straight to the engine as UTF-8, unless the
+				// cache needs the source as a wide string.
+				if (script.file && options.cacheDirectory.empty())
+					wrapper.ExecuteFile(Jsrt::FromUtf8(script.name.data(), script.name.length()));
+				else if (options.cacheDirectory.empty())
+					wrapper.ExecuteUtf8(script.source);
+				else
+					wrapper.Execute(CodeOf(script));
+			}
+			catch (Exception::Script& scriptException)
+			{
+				int status = ReportException(script.name, scriptException);
+				if (options.memoryStats)
+					ReportMemory(script.name, wrapper);
+				return status;
+			}
+
+			if (options.memoryStats)
+				ReportMemory(script.name, wrapper);
+		}
+
+		// Keep going until every timer (setTimeout, setInterval, sleep) has fired.
+		try
+		{
+			RunEventLoop(wrapper);
+		}
+		catch (Exception::Script& scriptException)
+		{
+			return ReportException("<timer>", scriptException);
+		}
+
+		return 0;
+	}
+
+	// pProfile, if set, collects samples from every script and its timers.
+	int RunScripts(const Options& options, JsWrapper::IJsWrapper& wrapper, JsWrapper::SamplingProfile* pProfile)
+	{
+		if (pProfile)
+			wrapper.StartProfiling(*pProfile);
+		int status = RunScriptsAndTimers(options, wrapper);
+		if (pProfile)
+			wrapper.StopProfiling();
+
+		return status;
+	}
+
+	int RunSequential(const Options& options, const JsWrapper::Settings& settings, std::FILE* pOutput)
+	{
+		using namespace JsWrapper;
+
+		std::unique_ptr<IConsole> psConsole = std::make_unique<StreamConsole>(pOutput, options.echoState);
+
+		std::FILE* pLog = nullptr;
+		if (!options.recordPath.empty())
+		{
+			pLog = std::fopen(options.recordPath.c_str(), "wb");
+			if (!pLog)
+				throw std::runtime_error("Unable to open " + options.recordPath);
+			psConsole = std::make_unique<ConsoleRecorder>(std::move(psConsole), pLog);
+		}
+
+		std::unique_ptr<IJsWrapper> pWrapper = CreateInstance(std::move(psConsole), settings);
+
+		SamplingProfile profile;
+		int status = RunScripts(options, *pWrapper, options.profilePath.empty() ? nullptr : &profile);
+		if (!options.profilePath.empty())
+			WriteFile(options.profilePath, profile.Folded());
+		if (!options.statsPath.empty())
+			WriteFile(options.statsPath, FormatPrometheus(pWrapper->GetCallStats()));
+
+		// The recorder goes with the wrapper, flushing the log.
+		pWrapper.reset();
+		if (pLog)
+			std::fclose(pLog);
+
+		return status;
+	}
+
+	int RunReplay(const Options& options, std::FILE* pOutput)
+	{
+		using namespace JsWrapper;
+
+		std::FILE* pLog = std::fopen(options.replayPath.c_str(), "rb");
+		if (!pLog)
+			throw std::runtime_error("Unable to open " + options.replayPath);
+		ConsoleReplayer replayer(pLog);
+		std::fclose(pLog);
+
+		StreamConsole console(pOutput, options.echoState);
+		replayer.Replay(console, options.realTime ? ConsoleReplayer::Pace::RealTime : ConsoleReplayer::Pace::AsFastAsPossible);
+		return 0;
+	}
+
+	int RunParallel(const Options& options, const JsWrapper::Settings& settings, std::FILE* pOutput)
+	{
+		using namespace JsWrapper;
+
+		ScriptExecutor executor(options.workers, [&options, pOutput](size_t) { return std::make_unique<StreamConsole>(pOutput, options.echoState); }, settings);
+
+		std::vector<std::future<void>> results;
+		for (auto& script : options.scripts)
+			results.push_back(executor.Submit(CodeOf(script)));
+
+		int status = 0;
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			try
+			{
+				results[i].get();
+			}
+			catch (Exception::Script& scriptException)
+			{
+				status = std::max(status, ReportException(options.scripts[i].name, scriptException));
+			}
+		}
+
+		return status;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace JsWrapper;
+
+	std::FILE* pOutput = stdout;
+	int status;
+
+	try
+	{
+		Options options;
+		if (!ParseArguments(argc, argv, options))
+		{
+			PrintUsage();
+			return 2;
+		}
+
+		if (!options.outputPath.empty())
+		{
+			pOutput = std::fopen(options.outputPath.c_str(), "wb");
+			if (!pOutput)
+				throw std::runtime_error("Unable to open " + options.outputPath);
+		}
+
+		Settings settings;
+		settings.bytecodeCacheDirectory = Jsrt::FromUtf8(options.cacheDirectory.data(), options.cacheDirectory.length());
+		settings.memoryLimit = options.memoryLimit;
+		settings.recycleAfterBytes = options.recycleAfterBytes;
+		settings.executionTimeout = std::chrono::milliseconds(options.timeoutMilliseconds);
+
+		if (!options.tracePath.empty())
+		{
+			Tracer::SetThreadName("main");
+			Tracer::Start();
+		}
+
+		if (!options.replayPath.empty())
+			status = RunReplay(options, pOutput);
+		else
+			status = options.workers ? RunParallel(options, settings, pOutput) : RunSequential(options, settings, pOutput);
+
+		if (!options.tracePath.empty())
+		{
+			Tracer::Stop();
+			WriteFile(options.tracePath, Tracer::ToJson());
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::fprintf(stderr, "jsexec: %s\n", e.what());
+		status = 2;
+	}
+
+	if (pOutput != stdout)
+		std::fclose(pOutput);
+
+	return status;
+}
+
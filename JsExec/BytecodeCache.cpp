@@ -0,0 +1,422 @@
+#include "pch.h"
+#include "BytecodeCache.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#if defined(JSEXEC_CHAKRACORE) && defined(JSEXEC_HAS_CHAKRACORE_VERSION)
+#include <ChakraCoreVersion.h>
+#endif
+
+namespace
+{
+	const uint32_t kMagic = 0x4342584A; // "JXBC"
+	const uint32_t kFormatVersion = 2;
+
+	// Followed by the source (sourceLength wchar_t, padded to 64 bytes), then the bytecode.
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t formatVersion;
+		uint64_t engineTag;
+		uint64_t sourceHash;
+		uint64_t sourceLength;
+		uint64_t bytecodeSize;
+		uint64_t bytecodeChecksum;
+		uint64_t reserved[2]; // Keeps the source and bytecode 64 byte aligned in the mapping.
+	};
+	static_assert(sizeof(FileHeader) == 64, "FileHeader layout changed");
+
+	size_t SourceBytes(uint64_t sourceLength)
+	{
+		return static_cast<size_t>(sourceLength) * sizeof(wchar_t);
+	}
+
+	size_t BytecodeOffset(uint64_t sourceLength)
+	{
+		return sizeof(FileHeader) + ((SourceBytes(sourceLength) + 63) & ~static_cast<size_t>(63));
+	}
+
+	void Count(std::atomic<unsigned long long>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// Bytecode is only valid for the engine build and architecture that produced it.
+	uint64_t EngineTag()
+	{
+		uint64_t tag = (static_cast<uint64_t>(sizeof(void*)) << 8) | sizeof(wchar_t);
+#ifdef JSEXEC_CHAKRACORE
+		tag |= 1ull << 63;
+#ifdef JSEXEC_HAS_CHAKRACORE_VERSION
+		tag |= (static_cast<uint64_t>(CHAKRA_CORE_MAJOR_VERSION) << 48) | (static_cast<uint64_t>(CHAKRA_CORE_MINOR_VERSION) << 32) | (static_cast<uint64_t>(CHAKRA_CORE_PATCH_VERSION) << 16);
+#endif
+#endif
+		// Without a version number the engine still rejects foreign bytecode with
+		// JsErrorBadSerializedScript, the file is rebuilt in that case.
+		return tag;
+	}
+
+	// 64-bit FNV-1a, a word at a time.
+	uint64_t Hash(const void* pData, size_t size)
+	{
+		const uint64_t prime = 0x100000001B3ull;
+		uint64_t hash = 0xCBF29CE484222325ull ^ size;
+
+		const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, pBytes + i, sizeof(word));
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 29;
+		}
+		for (; i < size; i++)
+			hash = (hash ^ pBytes[i]) * prime;
+
+		return hash;
+	}
+
+	uint64_t HashSource(const std::wstring& code)
+	{
+		return Hash(code.data(), code.length() * sizeof(wchar_t));
+	}
+
+	std::FILE* OpenForWrite(const std::wstring& path)
+	{
+#ifdef _WIN32
+		return _wfopen(path.c_str(), L"wb");
+#else
+		return std::fopen(JsWrapper::Jsrt::ToUtf8(path.c_str(), path.length()).c_str(), "wb");
+#endif
+	}
+
+	void RemoveFile(const std::wstring& path)
+	{
+#ifdef _WIN32
+		_wremove(path.c_str());
+#else
+		std::remove(JsWrapper::Jsrt::ToUtf8(path.c_str(), path.length()).c_str());
+#endif
+	}
+
+	bool ReplaceFile(const std::wstring& from, const std::wstring& to)
+	{
+#ifdef _WIN32
+		_wremove(to.c_str());
+		return _wrename(from.c_str(), to.c_str()) == 0;
+#else
+		return std::rename(JsWrapper::Jsrt::ToUtf8(from.c_str(), from.length()).c_str(), JsWrapper::Jsrt::ToUtf8(to.c_str(), to.length()).c_str()) == 0;
+#endif
+	}
+
+	void CreateDirectoryIfMissing(const std::wstring& directory)
+	{
+#ifdef _WIN32
+		CreateDirectoryW(directory.c_str(), nullptr);
+#else
+		mkdir(JsWrapper::Jsrt::ToUtf8(directory.c_str(), directory.length()).c_str(), 0755);
+#endif
+	}
+
+	void ClearPendingException()
+	{
+		bool hasException = false;
+		if (JsHasException(&hasException) == JsNoError && hasException)
+		{
+			JsValueRef exception;
+			JsGetAndClearException(&exception);
+		}
+	}
+}
+
+namespace JsWrapper
+{
+
+BytecodeCache::BytecodeCache(const std::wstring& directory) : m_directory(directory)
+{
+	if (!m_directory.empty() && m_directory.back() != L'/' && m_directory.back() != L'\\')
+		m_directory.push_back(L'/');
+
+	CreateDirectoryIfMissing(m_directory);
+}
+
+BytecodeCache::~BytecodeCache() = default;
+
+std::wstring BytecodeCache::FileName(const std::wstring& code)
+{
+	return FileName(HashSource(code));
+}
+
+std::wstring BytecodeCache::FileName(uint64_t sourceHash)
+{
+	wchar_t wzName[32];
+	swprintf(wzName, sizeof(wzName) / sizeof(wzName[0]), L"%016llx.jsbc", static_cast<unsigned long long>(sourceHash));
+	return wzName;
+}
+
+std::wstring BytecodeCache::PathFor(uint64_t sourceHash) const
+{
+	return m_directory + FileName(sourceHash);
+}
+
+BytecodeCacheStats BytecodeCache::GetStats() const
+{
+	BytecodeCacheStats stats;
+	stats.hits = m_hits.load(std::memory_order_relaxed);
+	stats.misses = m_misses.load(std::memory_order_relaxed);
+	stats.rejected = m_rejected.load(std::memory_order_relaxed);
+	stats.writes = m_writes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+JsErrorCode BytecodeCache::Run(const std::wstring& code, JsValueRef* result)
+{
+	uint64_t sourceHash = HashSource(code);
+
+	// A hit runs bytecode serialized by an earlier run, mapped or from disk.
+	// The run that serializes a script has parsed it and is a miss.
+	bool serializedEarlier = true;
+	std::shared_ptr<Script> psScript;
+	auto it = m_scripts.find(sourceHash);
+	if (it != m_scripts.end())
+	{
+		m_recent.splice(m_recent.begin(), m_recent, it->second);
+		psScript = it->second->second;
+	}
+	else
+	{
+		psScript = std::make_shared<Script>();
+		psScript->psBytecode = Load(sourceHash, code);
+		if (!psScript->psBytecode)
+		{
+			serializedEarlier = false;
+			if (Store(sourceHash, code))
+				psScript->psBytecode = Load(sourceHash, code);
+		}
+
+		// Only keep scripts we can run from bytecode, everything else runs from source.
+		if (psScript->psBytecode)
+		{
+			psScript->source = code;
+			m_recent.emplace_front(sourceHash, psScript);
+			m_scripts[sourceHash] = m_recent.begin();
+
+			// Scripts still in use by the engine stay mapped until it lets go of them.
+			if (m_recent.size() > kMaxScripts)
+			{
+				m_scripts.erase(m_recent.back().first);
+				m_recent.pop_back();
+			}
+		}
+		else
+		{
+			psScript.reset();
+		}
+	}
+
+	if (psScript && psScript->source == code)
+	{
+		JsErrorCode error = RunSerialized(psScript, result);
+		if (error != JsErrorBadSerializedScript)
+		{
+			Count(serializedEarlier ? m_hits : m_misses);
+			return error;
+		}
+
+		// Valid file, but the engine didn't accept it (different engine build).
+		// The mapping goes once the engine has released it.
+		Count(m_rejected);
+		RemoveFile(PathFor(sourceHash));
+		m_recent.erase(m_scripts[sourceHash]);
+		m_scripts.erase(sourceHash);
+	}
+
+	Count(m_misses);
+	return Jsrt::RunScript(code.c_str(), JS_SOURCE_CONTEXT_NONE, L"", result);
+}
+
+std::unique_ptr<MappedFile> BytecodeCache::Load(uint64_t sourceHash, const std::wstring& code)
+{
+	std::wstring path = PathFor(sourceHash);
+	std::unique_ptr<MappedFile> psFile = MappedFile::Open(path);
+	if (!psFile)
+		return nullptr;
+
+	// The hash only picks the file: another source can have the same one, so
+	// the stored source must be the code itself.
+	const size_t bytecodeOffset = BytecodeOffset(code.length());
+	bool valid = psFile->Size() > bytecodeOffset;
+	if (valid)
+	{
+		FileHeader header;
+		std::memcpy(&header, psFile->Data(), sizeof(header));
+
+		valid = header.magic == kMagic
+			&& header.formatVersion == kFormatVersion
+			&& header.engineTag == EngineTag()
+			&& header.sourceHash == sourceHash
+			&& header.sourceLength == code.length()
+			&& header.bytecodeSize == psFile->Size() - bytecodeOffset
+			&& std::memcmp(psFile->Data() + sizeof(FileHeader), code.data(), SourceBytes(code.length())) == 0
+			&& header.bytecodeChecksum == Hash(psFile->Data() + bytecodeOffset, static_cast<size_t>(header.bytecodeSize));
+	}
+
+	if (!valid)
+	{
+		Count(m_rejected);
+		psFile.reset();
+		RemoveFile(path);
+	}
+
+	return psFile;
+}
+
+bool BytecodeCache::Store(uint64_t sourceHash, const std::wstring& code)
+{
+	const unsigned char* pBytecode = nullptr;
+	size_t bytecodeSize = 0;
+
+#ifdef JSEXEC_CHAKRACORE
+	JsValueRef script;
+	if (Jsrt::PointerToString(code.c_str(), code.length(), &script) != JsNoError)
+		return false;
+
+	JsValueRef buffer;
+	if (JsSerialize(script, &buffer, JsParseScriptAttributeNone) != JsNoError)
+	{
+		// Compile errors get reported when the source runs.
+		ClearPendingException();
+		return false;
+	}
+
+	ChakraBytePtr pStorage;
+	unsigned int storageSize;
+	if (JsGetArrayBufferStorage(buffer, &pStorage, &storageSize) != JsNoError)
+		return false;
+
+	pBytecode = pStorage;
+	bytecodeSize = storageSize;
+#else
+	unsigned long serializedSize = 0;
+	if (JsSerializeScript(code.c_str(), nullptr, &serializedSize) != JsNoError)
+	{
+		ClearPendingException();
+		return false;
+	}
+
+	std::vector<BYTE> serialized(serializedSize);
+	if (JsSerializeScript(code.c_str(), serialized.data(), &serializedSize) != JsNoError)
+		return false;
+
+	pBytecode = serialized.data();
+	bytecodeSize = serializedSize;
+#endif
+
+	FileHeader header = {};
+	header.magic = kMagic;
+	header.formatVersion = kFormatVersion;
+	header.engineTag = EngineTag();
+	header.sourceHash = sourceHash;
+	header.sourceLength = code.length();
+	header.bytecodeSize = bytecodeSize;
+	header.bytecodeChecksum = Hash(pBytecode, bytecodeSize);
+
+	// Write to a temporary name first so a concurrent reader never maps a partial file.
+	std::wstring path = PathFor(sourceHash);
+	std::wstring tempPath = path + L".tmp";
+	std::FILE* pFile = OpenForWrite(tempPath);
+	if (!pFile)
+		return false;
+
+	const size_t sourceBytes = SourceBytes(code.length());
+	const size_t padBytes = BytecodeOffset(code.length()) - sizeof(FileHeader) - sourceBytes;
+	const unsigned char padding[64] = {};
+	bool written = std::fwrite(&header, sizeof(header), 1, pFile) == 1
+		&& std::fwrite(code.data(), 1, sourceBytes, pFile) == sourceBytes
+		&& std::fwrite(padding, 1, padBytes, pFile) == padBytes
+		&& std::fwrite(pBytecode, 1, bytecodeSize, pFile) == bytecodeSize;
+	written = (std::fclose(pFile) == 0) && written;
+
+	if (!written || !ReplaceFile(tempPath, path))
+	{
+		RemoveFile(tempPath);
+		return false;
+	}
+
+	Count(m_writes);
+	return true;
+}
+
+#ifdef JSEXEC_CHAKRACORE
+
+bool CHAKRA_CALLBACK BytecodeCache::LoadSource(JsSourceContext sourceContext, JsValueRef* value, JsParseScriptAttributes* parseAttributes)
+{
+	const Script& script = **reinterpret_cast<const ScriptHolder*>(sourceContext);
+	*parseAttributes = JsParseScriptAttributeNone;
+	return Jsrt::PointerToString(script.source.c_str(), script.source.length(), value) == JsNoError;
+}
+
+// Finalizer of the bytecode buffer. The engine reads the source through it
+// too, so after this it needs neither.
+void CHAKRA_CALLBACK BytecodeCache::ReleaseScript(void* data)
+{
+	delete static_cast<ScriptHolder*>(data);
+}
+
+JsErrorCode BytecodeCache::RunSerialized(const std::shared_ptr<Script>& psScript, JsValueRef* result)
+{
+	MappedFile& bytecode = *psScript->psBytecode;
+	const size_t bytecodeOffset = BytecodeOffset(psScript->source.length());
+
+	std::unique_ptr<ScriptHolder> psHolder(new ScriptHolder(psScript));
+	JsValueRef buffer;
+	JsErrorCode error = JsCreateExternalArrayBuffer(bytecode.Data() + bytecodeOffset, static_cast<unsigned int>(bytecode.Size() - bytecodeOffset), &BytecodeCache::ReleaseScript, psHolder.get(), &buffer);
+	if (error != JsNoError)
+		return error;
+	ScriptHolder* pHolder = psHolder.release(); // the buffer's now
+
+	JsValueRef sourceUrl;
+	error = Jsrt::PointerToString(L"", 0, &sourceUrl);
+	if (error != JsNoError)
+		return error;
+
+	return JsRunSerialized(buffer, &BytecodeCache::LoadSource, reinterpret_cast<JsSourceContext>(pHolder), sourceUrl, result);
+}
+
+#else
+
+bool CALLBACK BytecodeCache::LoadSource(JsSourceContext sourceContext, const wchar_t** wzSource)
+{
+	*wzSource = (*reinterpret_cast<const ScriptHolder*>(sourceContext))->source.c_str();
+	return true;
+}
+
+// The engine is done with the script's bytecode and source.
+void CALLBACK BytecodeCache::ReleaseScript(JsSourceContext sourceContext)
+{
+	delete reinterpret_cast<ScriptHolder*>(sourceContext);
+}
+
+JsErrorCode BytecodeCache::RunSerialized(const std::shared_ptr<Script>& psScript, JsValueRef* result)
+{
+	MappedFile& bytecode = *psScript->psBytecode;
+
+	// The engine calls ReleaseScript for every script handed to it, also one it rejects.
+	ScriptHolder* pHolder = new ScriptHolder(psScript);
+	return JsRunSerializedScriptWithCallback(&BytecodeCache::LoadSource, &BytecodeCache::ReleaseScript, bytecode.Data() + BytecodeOffset(psScript->source.length()), reinterpret_cast<JsSourceContext>(pHolder), L"", result);
+}
+
+#endif
+
+}
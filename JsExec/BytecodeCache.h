@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "JsWrapper.h"
+#include "JsrtCompat.h"
+
+namespace JsWrapper
+{
+
+class MappedFile;
+
+// On-disk cache of serialized scripts. Each distinct source is stored once as
+// <directory>/<source hash>.jsbc, with a copy of the source ahead of the
+// bytecode. Files are memory-mapped and validated against a header (format,
+// engine version, source hash/length, bytecode checksum) and the stored source
+// before the engine sees them; anything that doesn't match is deleted and rebuilt.
+//
+// The engine keeps referring to both the bytecode and the source after a run
+// (functions are deserialized lazily), so each run holds on to its script
+// until the engine lets go of it (its bytecode buffer is collected). Besides
+// those the cache keeps the kMaxScripts most recently run scripts mapped.
+class BytecodeCache
+{
+public:
+	static const size_t kMaxScripts = 32;
+
+	// The directory is created if it doesn't exist.
+	explicit BytecodeCache(const std::wstring& directory);
+	~BytecodeCache();
+
+	// The name of the file code is cached in, within the directory.
+	static std::wstring FileName(const std::wstring& code);
+
+	// Same contract as Jsrt::RunScript, must be called with the context current.
+	JsErrorCode Run(const std::wstring& code, JsValueRef* result);
+
+	// Any thread.
+	BytecodeCacheStats GetStats() const;
+
+private:
+	struct Script
+	{
+		std::wstring source;
+		std::unique_ptr<MappedFile> psBytecode;
+	};
+
+	BytecodeCache(const BytecodeCache&) = delete;
+	BytecodeCache& operator=(const BytecodeCache&) = delete;
+
+	static std::wstring FileName(uint64_t sourceHash);
+	std::wstring PathFor(uint64_t sourceHash) const;
+	std::unique_ptr<MappedFile> Load(uint64_t sourceHash, const std::wstring& code);
+	bool Store(uint64_t sourceHash, const std::wstring& code);
+	JsErrorCode RunSerialized(const std::shared_ptr<Script>& psScript, JsValueRef* result);
+
+	// The engine's reference to a script, released when the engine is done with it.
+	using ScriptHolder = std::shared_ptr<Script>;
+
+#ifdef JSEXEC_CHAKRACORE
+	static bool CHAKRA_CALLBACK LoadSource(JsSourceContext sourceContext, JsValueRef* value, JsParseScriptAttributes* parseAttributes);
+	static void CHAKRA_CALLBACK ReleaseScript(void* data);
+#else
+	static bool CALLBACK LoadSource(JsSourceContext sourceContext, const wchar_t** wzSource);
+	static void CALLBACK ReleaseScript(JsSourceContext sourceContext);
+#endif
+
+	using Recent = std::list<std::pair<uint64_t, std::shared_ptr<Script>>>; // most recently run first
+
+	std::wstring m_directory;
+	Recent m_recent;
+	std::unordered_map<uint64_t, Recent::iterator> m_scripts;
+
+	// Written by the runtime thread only.
+	std::atomic<unsigned long long> m_hits { 0 };
+	std::atomic<unsigned long long> m_misses { 0 };
+	std::atomic<unsigned long long> m_rejected { 0 };
+	std::atomic<unsigned long long> m_writes { 0 };
+};
+
+}
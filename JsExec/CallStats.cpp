@@ -0,0 +1,195 @@
+#include "pch.h"
+#include "CallStats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "JsrtCompat.h"
+
+namespace
+{
+	// Single writer, see LatencyHistogram.
+	void Add(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	unsigned HighestBit(uint64_t value)
+	{
+		unsigned bit = 0;
+		for (unsigned shift = 32; shift > 0; shift /= 2)
+		{
+			if (value >> shift)
+			{
+				value >>= shift;
+				bit += shift;
+			}
+		}
+		return bit;
+	}
+
+	void AppendLabels(std::string& text, const std::string& call, const std::string& labels, const char* szExtra)
+	{
+		text += "{call=\"";
+		for (char ch : call)
+		{
+			if (ch == '\\' || ch == '"')
+				text += '\\';
+			text += ch;
+		}
+		text += '"';
+		if (!labels.empty())
+			text += "," + labels;
+		if (szExtra)
+			text += szExtra;
+		text += '}';
+	}
+
+	void AppendValue(std::string& text, double value)
+	{
+		char szValue[32];
+		std::snprintf(szValue, sizeof(szValue), " %.9g\n", value);
+		text += szValue;
+	}
+}
+
+namespace JsWrapper
+{
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (auto& bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	m_total.store(0, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds)
+{
+	Add(m_buckets[BucketOf(nanoseconds)], 1);
+	Add(m_total, nanoseconds);
+	if (nanoseconds > m_max.load(std::memory_order_relaxed))
+		m_max.store(nanoseconds, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Count() const
+{
+	uint64_t count = 0;
+	for (auto& bucket : m_buckets)
+		count += bucket.load(std::memory_order_relaxed);
+	return count;
+}
+
+uint64_t LatencyHistogram::ValueAtQuantile(double quantile) const
+{
+	uint64_t counts[kBucketCount];
+	uint64_t count = 0;
+	for (unsigned i = 0; i < kBucketCount; i++)
+	{
+		counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+		count += counts[i];
+	}
+
+	if (count == 0)
+		return 0;
+
+	// The rank of the sample we're after, 1-based.
+	uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < kBucketCount; i++)
+	{
+		seen += counts[i];
+		if (seen >= rank)
+			return std::min(ValueOf(i), Max());
+	}
+	return Max();
+}
+
+unsigned LatencyHistogram::BucketOf(uint64_t value)
+{
+	value = std::min<uint64_t>(value, (uint64_t(1) << (kHighestBit + 1)) - 1);
+	if (value < 2 * kHalfSubBuckets)
+		return static_cast<unsigned>(value);
+
+	// The top kSubBucketBits bits of the value pick the bucket within its power of two.
+	unsigned shift = HighestBit(value) - kSubBucketBits + 1;
+	return shift * kHalfSubBuckets + static_cast<unsigned>(value >> shift);
+}
+
+uint64_t LatencyHistogram::ValueOf(unsigned bucket)
+{
+	if (bucket < 2 * kHalfSubBuckets)
+		return bucket;
+
+	unsigned shift = bucket / kHalfSubBuckets - 1;
+	uint64_t low = static_cast<uint64_t>(bucket - shift * kHalfSubBuckets) << shift;
+	return low + ((uint64_t(1) << shift) / 2);
+}
+
+CallStatistics::CallStatistics(const std::vector<const wchar_t*>& functionNames) : m_psCounters(new CallCounters[1 + functionNames.size()])
+{
+	m_names.reserve(1 + functionNames.size());
+	m_names.push_back(L"Execute");
+	m_names.insert(m_names.end(), functionNames.begin(), functionNames.end());
+}
+
+std::vector<CallStats> CallStatistics::Snapshot() const
+{
+	std::vector<CallStats> snapshot(m_names.size());
+	for (size_t i = 0; i < m_names.size(); i++)
+	{
+		const CallCounters& counters = m_psCounters[i];
+		CallStats& stats = snapshot[i];
+		stats.name = m_names[i];
+		stats.calls = counters.latency.Count();
+		stats.failures = counters.failures.load(std::memory_order_relaxed);
+		stats.totalNanoseconds = counters.latency.Total();
+		stats.p50Nanoseconds = counters.latency.ValueAtQuantile(0.5);
+		stats.p90Nanoseconds = counters.latency.ValueAtQuantile(0.9);
+		stats.p99Nanoseconds = counters.latency.ValueAtQuantile(0.99);
+		stats.maxNanoseconds = counters.latency.Max();
+	}
+	return snapshot;
+}
+
+std::string FormatPrometheus(const std::vector<CallStats>& stats, const std::string& labels)
+{
+	const struct { const char* szQuantile; unsigned long long CallStats::*pValue; } quantiles[] = {
+		{ ",quantile=\"0.5\"", &CallStats::p50Nanoseconds },
+		{ ",quantile=\"0.9\"", &CallStats::p90Nanoseconds },
+		{ ",quantile=\"0.99\"", &CallStats::p99Nanoseconds },
+	};
+
+	std::string text;
+	text += "# HELP jsexec_call_duration_seconds Time spent in Execute and in each host function called from script.\n";
+	text += "# TYPE jsexec_call_duration_seconds summary\n";
+	for (auto& call : stats)
+	{
+		std::string name = Jsrt::ToUtf8(call.name.c_str(), call.name.length());
+		for (auto& quantile : quantiles)
+		{
+			text += "jsexec_call_duration_seconds";
+			AppendLabels(text, name, labels, quantile.szQuantile);
+			AppendValue(text, call.*quantile.pValue / 1e9);
+		}
+		text += "jsexec_call_duration_seconds_sum";
+		AppendLabels(text, name, labels, nullptr);
+		AppendValue(text, call.totalNanoseconds / 1e9);
+		text += "jsexec_call_duration_seconds_count";
+		AppendLabels(text, name, labels, nullptr);
+		text += " " + std::to_string(call.calls) + "\n";
+	}
+
+	text += "# HELP jsexec_call_failures_total Calls that threw: script exceptions for Execute, rejected arguments or host errors otherwise.\n";
+	text += "# TYPE jsexec_call_failures_total counter\n";
+	for (auto& call : stats)
+	{
+		text += "jsexec_call_failures_total";
+		AppendLabels(text, Jsrt::ToUtf8(call.name.c_str(), call.name.length()), labels, nullptr);
+		text += " " + std::to_string(call.failures) + "\n";
+	}
+
+	return text;
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// Latency histogram in the style of HdrHistogram: values below 32 get a bucket
+// each, above that every power of two is split into 16 linear buckets, so a
+// recorded value is off by at most 1/16 of itself. Values past ~68s (2^36 ns)
+// share the last bucket, the exact maximum is kept separately.
+//
+// There is one writer, the runtime thread, so recording is plain relaxed
+// loads and stores with no locked instructions. Readers on other threads may
+// see a value recorded halfway, which is off by one sample at most.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Record(uint64_t nanoseconds);
+
+	uint64_t Count() const;
+	uint64_t Total() const { return m_total.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return m_max.load(std::memory_order_relaxed); }
+
+	// The recorded value at quantile (0..1), to the precision of its bucket.
+	uint64_t ValueAtQuantile(double quantile) const;
+
+private:
+	static const unsigned kSubBucketBits = 5;
+	static const unsigned kHalfSubBuckets = 1 << (kSubBucketBits - 1);
+	static const unsigned kHighestBit = 35;
+	static const unsigned kBucketCount = (kHighestBit - kSubBucketBits + 3) * kHalfSubBuckets;
+
+	static unsigned BucketOf(uint64_t value);
+	static uint64_t ValueOf(unsigned bucket); // middle of the bucket
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	std::atomic<uint64_t> m_buckets[kBucketCount];
+	std::atomic<uint64_t> m_total;
+	std::atomic<uint64_t> m_max;
+};
+
+// Latency and failures of one host entry point.
+struct CallCounters
+{
+	LatencyHistogram latency;
+	std::atomic<uint64_t> failures { 0 };
+
+	// Runtime thread only.
+	void Record(std::chrono::steady_clock::duration elapsed, bool failed)
+	{
+		latency.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+		if (failed)
+			failures.store(failures.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+};
+
+// The counters of one wrapper: Execute, then one per global function in
+// registration order. Recorded on the runtime thread, read from any thread.
+class CallStatistics
+{
+public:
+	static const size_t Execute = 0;
+
+	explicit CallStatistics(const std::vector<const wchar_t*>& functionNames);
+
+	CallCounters& Counters(size_t index) { return m_psCounters[index]; }
+	CallCounters& Function(size_t function) { return m_psCounters[1 + function]; }
+
+	std::vector<CallStats> Snapshot() const;
+
+private:
+	CallStatistics(const CallStatistics&) = delete;
+	CallStatistics& operator=(const CallStatistics&) = delete;
+
+	std::vector<const wchar_t*> m_names;
+	std::unique_ptr<CallCounters[]> m_psCounters;
+};
+
+// Prometheus text exposition format: a summary per call (p50/p90/p99, sum and
+// count in seconds) and a failure counter. labels (e.g. "worker=\"0\"") is
+// added to every sample.
+std::string FormatPrometheus(const std::vector<CallStats>& stats, const std::string& labels = std::string());
+
+}
@@ -0,0 +1,279 @@
+#include "pch.h"
+#include "CommandRing.h"
+
+#include <cstring>
+
+#include "Tracer.h"
+
+namespace
+{
+	struct RecordHeader
+	{
+		uint32_t kind;
+		uint32_t bytes; // payload, the record is padded to a multiple of 8
+	};
+	static_assert(sizeof(RecordHeader) == sizeof(uint64_t), "a header is one ring slot");
+
+	enum Kind : uint32_t
+	{
+		KindPad = 0,      // skip to the start of the ring, a record never wraps
+		KindTextPart = 1, // leading piece of the text of the next Append or SetColor
+		KindAppend = 2,
+		KindSetColor = 3,
+		KindRotate = 4,
+		KindClear = 5
+	};
+
+	size_t Align8(size_t bytes)
+	{
+		return (bytes + 7) & ~static_cast<size_t>(7);
+	}
+
+	size_t RoundUpCapacity(size_t bytes)
+	{
+		size_t capacity = 4096;
+		while (capacity < bytes)
+			capacity *= 2;
+		return capacity;
+	}
+}
+
+namespace JsWrapper
+{
+
+CommandRing::CommandRing(size_t capacityBytes, DrainRequest requestDrain)
+	: m_capacity(RoundUpCapacity(capacityBytes)), m_maxPayload(m_capacity / 2 - sizeof(RecordHeader)), m_requestDrain(std::move(requestDrain)),
+	m_psRecords(new uint64_t[m_capacity / sizeof(uint64_t)])
+{
+}
+
+void CommandRing::Append(StringView text)
+{
+	WriteText(KindAppend, text);
+}
+
+void CommandRing::SetColor(StringView hexColor)
+{
+	WriteText(KindSetColor, hexColor);
+}
+
+void CommandRing::Rotate(double x, double y, double z)
+{
+	double* pPayload = reinterpret_cast<double*>(Reserve(KindRotate, 3 * sizeof(double)));
+	if (!pPayload)
+		return;
+
+	pPayload[0] = x;
+	pPayload[1] = y;
+	pPayload[2] = z;
+	Publish();
+}
+
+void CommandRing::Clear()
+{
+	if (Reserve(KindClear, 0))
+		Publish();
+}
+
+void CommandRing::WriteText(uint32_t kind, StringView text)
+{
+	// Pieces are published one at a time, so text longer than the whole ring
+	// still gets through while the consumer keeps draining.
+	const size_t maxChars = m_maxPayload / sizeof(wchar_t);
+	const wchar_t* wzText = text.Data();
+	size_t length = text.Length();
+
+	for (;;)
+	{
+		size_t chars = length > maxChars ? maxChars : length;
+		uint64_t* pPayload = Reserve(chars < length ? KindTextPart : kind, chars * sizeof(wchar_t));
+		if (!pPayload)
+			return;
+
+		std::memcpy(pPayload, wzText, chars * sizeof(wchar_t));
+		Publish();
+
+		if (chars == length)
+			break;
+		wzText += chars;
+		length -= chars;
+	}
+}
+
+uint64_t* CommandRing::Reserve(uint32_t kind, size_t payloadBytes)
+{
+	const size_t recordBytes = sizeof(RecordHeader) + Align8(payloadBytes);
+	uint64_t head = m_head.load(std::memory_order_relaxed);
+	size_t offset = static_cast<size_t>(head & (m_capacity - 1));
+	size_t padBytes = offset + recordBytes > m_capacity ? m_capacity - offset : 0;
+
+	// m_tailCache only moves forward, so it's refreshed just when the record
+	// doesn't fit behind the last value seen.
+	if (head + padBytes + recordBytes - m_tailCache > m_capacity)
+	{
+		m_tailCache = m_tail.load(std::memory_order_acquire);
+		if (head + padBytes + recordBytes - m_tailCache > m_capacity && !WaitForRoom(head + padBytes + recordBytes))
+			return nullptr;
+	}
+
+	if (padBytes > 0)
+	{
+		RecordHeader pad { KindPad, static_cast<uint32_t>(padBytes - sizeof(RecordHeader)) };
+		std::memcpy(&m_psRecords[offset / sizeof(uint64_t)], &pad, sizeof(pad));
+		head += padBytes;
+		offset = 0;
+	}
+
+	RecordHeader header { kind, static_cast<uint32_t>(payloadBytes) };
+	std::memcpy(&m_psRecords[offset / sizeof(uint64_t)], &header, sizeof(header));
+	m_reserved = head + recordBytes;
+	return &m_psRecords[offset / sizeof(uint64_t) + 1];
+}
+
+// Sleeps until the consumer has drained up to end - m_capacity. Returns false
+// if CancelWait or Close came first. Everything in the ring is published, so
+// a drain is already requested.
+bool CommandRing::WaitForRoom(uint64_t end)
+{
+	TraceSpan span("output", L"ring full");
+	m_producerWaits.store(m_producerWaits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	std::unique_lock<std::mutex> lock(m_roomLock);
+	const unsigned long long waitCancels = m_waitCancels;
+
+	// Pairs with the fence in Drain: either the consumer sees the flag and
+	// notifies, or the check below sees the room it made.
+	m_producerWaiting.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	m_roomAvailable.wait(lock, [this, end, waitCancels]()
+	{
+		m_tailCache = m_tail.load(std::memory_order_acquire);
+		return end - m_tailCache <= m_capacity || m_closed || m_waitCancels != waitCancels;
+	});
+	m_producerWaiting.store(false, std::memory_order_relaxed);
+
+	return end - m_tailCache <= m_capacity;
+}
+
+void CommandRing::Publish()
+{
+	m_head.store(m_reserved, std::memory_order_release);
+	m_records.store(m_records.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	if (m_requestDrain)
+	{
+		// Pairs with the fence in Drain: either the consumer sees this record or
+		// this sees the request it cleared, and asks again.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!m_drainRequested.load(std::memory_order_relaxed) && !m_drainRequested.exchange(true))
+			m_requestDrain();
+	}
+}
+
+size_t CommandRing::Drain(IConsole& console, const ClearHandler& onClear)
+{
+	if (m_requestDrain)
+	{
+		m_drainRequested.store(false, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	const uint64_t head = m_head.load(std::memory_order_acquire);
+	uint64_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail == head)
+		return 0;
+
+	TraceSpan span("output", L"drain");
+	size_t calls = 0;
+
+	while (tail != head)
+	{
+		const uint64_t* pRecord = &m_psRecords[static_cast<size_t>(tail & (m_capacity - 1)) / sizeof(uint64_t)];
+		RecordHeader header;
+		std::memcpy(&header, pRecord, sizeof(header));
+		const void* pPayload = pRecord + 1;
+
+		StringView text(static_cast<const wchar_t*>(pPayload), header.bytes / sizeof(wchar_t));
+		if ((header.kind == KindAppend || header.kind == KindSetColor) && !m_partial.empty())
+		{
+			m_partial.append(text.Data(), text.Length());
+			text = StringView(m_partial);
+		}
+
+		switch (header.kind)
+		{
+		case KindTextPart:
+			m_partial.append(text.Data(), text.Length());
+			break;
+		case KindAppend:
+			console.Append(text);
+			calls++;
+			break;
+		case KindSetColor:
+			console.SetColor(text);
+			calls++;
+			break;
+		case KindRotate:
+		{
+			const double* pValues = static_cast<const double*>(pPayload);
+			console.Rotate(pValues[0], pValues[1], pValues[2]);
+			calls++;
+			break;
+		}
+		case KindClear:
+			if (onClear)
+				onClear();
+			calls++;
+			break;
+		}
+
+		if (header.kind == KindAppend || header.kind == KindSetColor)
+			m_partial.clear();
+
+		// Hand the space back right away, a waiting producer needn't wait for the whole batch.
+		tail += sizeof(RecordHeader) + Align8(header.bytes);
+		m_tail.store(tail, std::memory_order_release);
+	}
+
+	m_batches.store(m_batches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	// Only a producer that found the ring full sleeps, the flag is rarely set.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_producerWaiting.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(m_roomLock);
+		m_roomAvailable.notify_one();
+	}
+
+	return calls;
+}
+
+void CommandRing::CancelWait()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_roomLock);
+		m_waitCancels++;
+	}
+	m_roomAvailable.notify_one();
+}
+
+void CommandRing::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_roomLock);
+		m_closed = true;
+	}
+	m_roomAvailable.notify_one();
+}
+
+CommandRing::Stats CommandRing::GetStats() const
+{
+	Stats stats;
+	stats.records = m_records.load(std::memory_order_relaxed);
+	stats.batches = m_batches.load(std::memory_order_relaxed);
+	stats.producerWaits = m_producerWaits.load(std::memory_order_relaxed);
+	return stats;
+}
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// Carries IConsole calls from the runtime thread to the UI thread without
+// locks or allocation on the script side. Each call is written as a fixed
+// layout record (an 8 byte header, then the text or the three doubles) into a
+// single-producer/single-consumer ring, and the consumer replays everything
+// written so far into an IConsole of its own in one batch.
+//
+// Like OutputBuffer, the first record after a drain calls requestDrain once so
+// the host can schedule the next one, typically on its next frame. When the
+// ring is full the producer sleeps until the consumer makes room, CancelWait
+// is called or the ring is closed; the call it was writing is dropped then.
+// State that only matters in its newest value is better kept out of the ring,
+// in a StateSlot, so it can't be held up by a consumer that isn't draining.
+//
+// Exactly one producer thread and one consumer thread.
+class CommandRing
+{
+public:
+	using DrainRequest = std::function<void()>;
+	using ClearHandler = std::function<void()>;
+
+	struct Stats
+	{
+		unsigned long long records { 0 };    // a split text counts once per piece
+		unsigned long long batches { 0 };
+		unsigned long long producerWaits { 0 }; // times a write found the ring full
+	};
+
+	// capacityBytes is rounded up to a power of two, at least 4KB. Text longer
+	// than half of it is split across records and joined again on replay.
+	explicit CommandRing(size_t capacityBytes, DrainRequest requestDrain = nullptr);
+
+	// Producer thread.
+	void Append(StringView text);
+	void SetColor(StringView hexColor);
+	void Rotate(double x, double y, double z);
+
+	// Producer thread. Marks the point where the consumer should forget what it
+	// has shown so far, in order with the calls around it.
+	void Clear();
+
+	// Consumer thread. Replays every record written so far into console, in
+	// order, and returns how many calls that was. The text passed to console
+	// points into the ring and is only valid during the call. Clear records go
+	// to onClear, or are skipped without one.
+	size_t Drain(IConsole& console, const ClearHandler& onClear = nullptr);
+
+	// Any thread. A producer waiting for room now gives up on that call, e.g.
+	// when the script writing it is being cancelled. Later calls wait as usual.
+	void CancelWait();
+
+	// Any thread. For when the consumer stops draining for good, e.g. before
+	// joining the producer thread: a producer waiting for room gives up, and so
+	// does every later call that doesn't fit.
+	void Close();
+
+	// Any thread.
+	Stats GetStats() const;
+
+private:
+	CommandRing(const CommandRing&) = delete;
+	CommandRing& operator=(const CommandRing&) = delete;
+
+	void WriteText(uint32_t kind, StringView text);
+	uint64_t* Reserve(uint32_t kind, size_t payloadBytes); // nullptr if the wait for room was given up
+	bool WaitForRoom(uint64_t end);
+	void Publish();
+
+	const size_t m_capacity; // bytes, a power of two
+	const size_t m_maxPayload;
+	const DrainRequest m_requestDrain;
+	std::unique_ptr<uint64_t[]> m_psRecords; // 8 byte aligned
+
+	// Producer side. m_head is the end of the last published record.
+	alignas(64) std::atomic<uint64_t> m_head { 0 };
+	uint64_t m_reserved { 0 };   // end of the record being written
+	uint64_t m_tailCache { 0 };  // last m_tail seen, refreshed only when the ring looks full
+	std::atomic<unsigned long long> m_records { 0 };
+	std::atomic<unsigned long long> m_producerWaits { 0 };
+
+	// A full ring's producer sleeps on m_roomAvailable with m_producerWaiting set.
+	std::mutex m_roomLock;
+	std::condition_variable m_roomAvailable;
+	std::atomic<bool> m_producerWaiting { false };
+	unsigned long long m_waitCancels { 0 }; // guarded by m_roomLock
+	bool m_closed { false };                // guarded by m_roomLock
+
+	// Consumer side. m_tail is the start of the oldest record not yet replayed.
+	alignas(64) std::atomic<uint64_t> m_tail { 0 };
+	std::atomic<bool> m_drainRequested { false };
+	std::atomic<unsigned long long> m_batches { 0 };
+	std::wstring m_partial; // text of a split Append so far
+};
+
+// The producer end of a CommandRing as the console of a wrapper.
+class RingConsole : public IConsole
+{
+public:
+	explicit RingConsole(const std::shared_ptr<CommandRing>& psRing) : m_psRing(psRing) { }
+
+	void Append(StringView text) override { m_psRing->Append(text); }
+	void SetColor(StringView hexColor) override { m_psRing->SetColor(hexColor); }
+	void Rotate(double x, double y, double z) override { m_psRing->Rotate(x, y, z); }
+
+private:
+	std::shared_ptr<CommandRing> m_psRing;
+};
+
+}
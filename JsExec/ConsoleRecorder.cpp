@@ -0,0 +1,267 @@
+#include "pch.h"
+#include "ConsoleRecorder.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include "JsrtCompat.h"
+
+namespace
+{
+	const char kMagic[8] = { 'J', 'S', 'C', 'L', 'O', 'G', '0', '1' };
+	const size_t kFlushBytes = 64 * 1024;
+
+	enum Kind : unsigned char
+	{
+		KindAppend = 1,
+		KindSetColor = 2,
+		KindRotate = 3
+	};
+
+	void AppendVarint(std::string& buffer, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back(static_cast<char>(value));
+	}
+
+	void AppendDouble(std::string& buffer, double value)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 8; i++)
+			buffer.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+	}
+
+	// Reads from a decoded log, throwing on truncation.
+	class Reader
+	{
+	public:
+		explicit Reader(const std::string& log) : m_pos(log.data()), m_end(log.data() + log.size()) { }
+
+		bool AtEnd() const { return m_pos == m_end; }
+
+		const char* Take(size_t count)
+		{
+			if (static_cast<size_t>(m_end - m_pos) < count)
+				throw std::runtime_error("Console log is truncated");
+			const char* p = m_pos;
+			m_pos += count;
+			return p;
+		}
+
+		unsigned char Byte() { return static_cast<unsigned char>(*Take(1)); }
+
+		uint64_t Varint()
+		{
+			uint64_t value = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7)
+			{
+				unsigned char byte = Byte();
+				value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					return value;
+			}
+			throw std::runtime_error("Console log is corrupt");
+		}
+
+		double Double()
+		{
+			const char* p = Take(8);
+			uint64_t bits = 0;
+			for (int i = 0; i < 8; i++)
+				bits |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+			double value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+	private:
+		const char* m_pos;
+		const char* m_end;
+	};
+}
+
+namespace JsWrapper
+{
+
+ConsoleRecorder::ConsoleRecorder(std::unique_ptr<IConsole>&& psInner, std::FILE* pLog) : m_psInner(std::move(psInner)), m_pLog(pLog), m_previous(Clock::now())
+{
+	m_buffer.reserve(kFlushBytes + 1024);
+	m_buffer.append(kMagic, sizeof(kMagic));
+}
+
+ConsoleRecorder::~ConsoleRecorder()
+{
+	Flush();
+}
+
+void ConsoleRecorder::Append(StringView text)
+{
+	BeginRecord(KindAppend);
+	AppendText(text);
+	EndRecord();
+
+	if (m_psInner)
+		m_psInner->Append(text);
+}
+
+void ConsoleRecorder::AppendUtf8(Utf8View text)
+{
+	BeginRecord(KindAppend);
+	AppendText(text);
+	EndRecord();
+
+	if (m_psInner)
+		m_psInner->AppendUtf8(text);
+}
+
+void ConsoleRecorder::SetColor(StringView hexColor)
+{
+	BeginRecord(KindSetColor);
+	AppendText(hexColor);
+	EndRecord();
+
+	if (m_psInner)
+		m_psInner->SetColor(hexColor);
+}
+
+void ConsoleRecorder::Rotate(double x, double y, double z)
+{
+	BeginRecord(KindRotate);
+	AppendDouble(m_buffer, x);
+	AppendDouble(m_buffer, y);
+	AppendDouble(m_buffer, z);
+	EndRecord();
+
+	if (m_psInner)
+		m_psInner->Rotate(x, y, z);
+}
+
+void ConsoleRecorder::Flush()
+{
+	if (!m_buffer.empty())
+		std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_pLog);
+	m_buffer.clear();
+	std::fflush(m_pLog);
+}
+
+void ConsoleRecorder::BeginRecord(unsigned char kind)
+{
+	// Advance by the rounded delay, so rounding doesn't add up over a long log.
+	auto delay = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_previous);
+	m_previous += delay;
+
+	m_buffer.push_back(static_cast<char>(kind));
+	AppendVarint(m_buffer, static_cast<uint64_t>(delay.count()));
+}
+
+void ConsoleRecorder::AppendText(StringView text)
+{
+	m_utf8.clear();
+	Jsrt::AppendUtf8(text.Data(), text.Length(), m_utf8);
+	AppendText(Utf8View(m_utf8));
+}
+
+void ConsoleRecorder::AppendText(Utf8View text)
+{
+	AppendVarint(m_buffer, text.Length());
+	m_buffer.append(text.Data(), text.Length());
+}
+
+void ConsoleRecorder::EndRecord()
+{
+	if (m_buffer.size() >= kFlushBytes)
+	{
+		std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_pLog);
+		m_buffer.clear();
+	}
+}
+
+ConsoleReplayer::ConsoleReplayer(std::FILE* pLog)
+{
+	std::string log;
+	char chunk[64 * 1024];
+	size_t read;
+	while ((read = std::fread(chunk, 1, sizeof(chunk), pLog)) > 0)
+		log.append(chunk, read);
+
+	Decode(log);
+}
+
+void ConsoleReplayer::Decode(const std::string& log)
+{
+	Reader reader(log);
+	if (std::memcmp(reader.Take(sizeof(kMagic)), kMagic, sizeof(kMagic)) != 0)
+		throw std::runtime_error("Not a console log");
+
+	std::chrono::microseconds at(0);
+	while (!reader.AtEnd())
+	{
+		Call call {};
+		call.kind = reader.Byte();
+		at += std::chrono::microseconds(reader.Varint());
+		call.at = at;
+
+		switch (call.kind)
+		{
+		case KindAppend:
+		case KindSetColor:
+		{
+			size_t length = static_cast<size_t>(reader.Varint());
+			std::wstring text = Jsrt::FromUtf8(reader.Take(length), length);
+			call.textOffset = m_text.size();
+			call.textLength = text.size();
+			m_text += text;
+			break;
+		}
+		case KindRotate:
+			call.x = reader.Double();
+			call.y = reader.Double();
+			call.z = reader.Double();
+			break;
+		default:
+			throw std::runtime_error("Console log is corrupt");
+		}
+
+		m_calls.push_back(call);
+	}
+}
+
+ConsoleReplayer::Stats ConsoleReplayer::Replay(IConsole& console, Pace pace) const
+{
+	Stats stats;
+	auto start = std::chrono::steady_clock::now();
+
+	for (const Call& call : m_calls)
+	{
+		if (pace == Pace::RealTime)
+			std::this_thread::sleep_until(start + call.at);
+
+		StringView text(m_text.data() + call.textOffset, call.textLength);
+		switch (call.kind)
+		{
+		case KindAppend:
+			console.Append(text);
+			stats.chars += call.textLength;
+			break;
+		case KindSetColor:
+			console.SetColor(text);
+			break;
+		case KindRotate:
+			console.Rotate(call.x, call.y, call.z);
+			break;
+		}
+
+		stats.calls++;
+		stats.recorded = call.at;
+	}
+
+	return stats;
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// Console logs: every IConsole call of a run with its time, so the output side
+// (OutputBuffer, the TextBox, the renderer) can be driven again later without
+// the script that produced it.
+//
+// Format: the 8 byte magic "JSCLOG01", then one record per call:
+//   kind        1 byte (1 Append, 2 SetColor, 3 Rotate)
+//   delay       varint, microseconds since the previous record
+//   Append and SetColor: varint byte count, then the text as UTF-8
+//   Rotate: x, y, z as little endian IEEE doubles
+
+// Forwards every call to an inner console, if any, and appends it to a log.
+class ConsoleRecorder : public IConsole
+{
+public:
+	// Does not take ownership of pLog.
+	ConsoleRecorder(std::unique_ptr<IConsole>&& psInner, std::FILE* pLog);
+	~ConsoleRecorder();
+
+	void Append(StringView text) override;
+	void SetColor(StringView hexColor) override;
+	void Rotate(double x, double y, double z) override;
+
+	// Whatever the inner console prefers, so its text isn't converted twice.
+	// Either encoding is recorded as it arrives, the log is UTF-8.
+	bool WantsUtf8() const override { return m_psInner ? m_psInner->WantsUtf8() : true; }
+	void AppendUtf8(Utf8View text) override;
+
+	// Writes buffered records to the log, also done every 64KB and on destruction.
+	void Flush();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	ConsoleRecorder(const ConsoleRecorder&) = delete;
+	ConsoleRecorder& operator=(const ConsoleRecorder&) = delete;
+
+	void BeginRecord(unsigned char kind);
+	void AppendText(StringView text);
+	void AppendText(Utf8View text);
+	void EndRecord();
+
+	std::unique_ptr<IConsole> m_psInner;
+	std::FILE* m_pLog;
+	std::string m_buffer;
+	std::string m_utf8; // reused for the conversion
+	Clock::time_point m_previous;
+};
+
+// Plays a console log back into any IConsole, either with the recorded
+// timing or as fast as possible. The log is decoded up front, so replaying
+// costs only the calls themselves.
+class ConsoleReplayer
+{
+public:
+	enum class Pace
+	{
+		AsFastAsPossible,
+		RealTime
+	};
+
+	struct Stats
+	{
+		unsigned long long calls { 0 };
+		unsigned long long chars { 0 };
+		std::chrono::microseconds recorded { 0 }; // from the start of the recording to the last call
+	};
+
+	// Reads the rest of pLog. Throws std::runtime_error if it isn't a console log.
+	explicit ConsoleReplayer(std::FILE* pLog);
+
+	// May be called any number of times.
+	Stats Replay(IConsole& console, Pace pace) const;
+
+	size_t CallCount() const { return m_calls.size(); }
+
+private:
+	struct Call
+	{
+		unsigned char kind;
+		std::chrono::microseconds at; // since recording started
+		size_t textOffset;            // into m_text, Append and SetColor
+		size_t textLength;
+		double x, y, z;               // Rotate
+	};
+
+	void Decode(const std::string& log);
+
+	std::vector<Call> m_calls;
+	std::wstring m_text;
+};
+
+}
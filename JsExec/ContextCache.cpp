@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "ContextCache.h"
+
+namespace
+{
+	const wchar_t* const kPropertyNames[] = { L"message" };
+	static_assert(sizeof(kPropertyNames) / sizeof(kPropertyNames[0]) == JsWrapper::ContextCache::PropertyCount, "kPropertyNames out of sync with ContextCache::Property");
+}
+
+namespace JsWrapper
+{
+
+JsErrorCode ContextCache::Build(const std::vector<const wchar_t*>& names)
+{
+	JsErrorCode error = JsGetGlobalObject(&m_global);
+	if (error == JsNoError)
+		error = JsGetUndefinedValue(&m_undefined);
+
+	m_ids.clear();
+	m_ids.reserve(PropertyCount + names.size());
+
+	auto intern = [this, &error](const wchar_t* wzName)
+	{
+		JsPropertyIdRef id = JS_INVALID_REFERENCE;
+		if (error == JsNoError)
+			error = Jsrt::GetPropertyIdFromName(wzName, &id);
+		if (error == JsNoError)
+			error = JsAddRef(id, nullptr);
+		m_ids.push_back(id);
+	};
+
+	for (const wchar_t* wzName : kPropertyNames)
+		intern(wzName);
+	for (const wchar_t* wzName : names)
+		intern(wzName);
+
+	return error;
+}
+
+void ContextCache::Release()
+{
+	for (JsPropertyIdRef id : m_ids)
+	{
+		if (id != JS_INVALID_REFERENCE)
+			JsRelease(id, nullptr);
+	}
+	m_ids.clear();
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "JsrtCompat.h"
+
+namespace JsWrapper
+{
+
+// Handles a context uses on every registration and error path, looked up once
+// when the context is created instead of per call.
+//
+// Build and Release must run with the context current. The global object and
+// undefined are owned by the context; the property ids are referenced from Build
+// until Release.
+class ContextCache
+{
+public:
+	// Well-known property names, indexes into the interned ids.
+	enum Property
+	{
+		Message,
+		PropertyCount
+	};
+
+	ContextCache() = default;
+
+	// Interns the well-known names plus the given names, reachable through Interned(i) in the same order.
+	JsErrorCode Build(const std::vector<const wchar_t*>& names);
+
+	// Drops the references Build took on the property ids.
+	void Release();
+
+	JsValueRef Global() const { return m_global; }
+	JsValueRef Undefined() const { return m_undefined; }
+	JsPropertyIdRef Id(Property property) const { return m_ids[property]; }
+	JsPropertyIdRef Interned(size_t index) const { return m_ids[PropertyCount + index]; }
+
+private:
+	ContextCache(const ContextCache&) = delete;
+	ContextCache& operator=(const ContextCache&) = delete;
+
+	JsValueRef m_global { JS_INVALID_REFERENCE };
+	JsValueRef m_undefined { JS_INVALID_REFERENCE };
+	std::vector<JsPropertyIdRef> m_ids;
+};
+
+}
@@ -0,0 +1,261 @@
+#include "pch.h"
+#include "EventLoop.h"
+
+#include <algorithm>
+
+namespace JsWrapper
+{
+
+void EventLoop::Attach(JsValueRef undefined)
+{
+	m_undefined = undefined;
+
+	JsErrorCode error = JsSetPromiseContinuationCallback(&EventLoop::OnPromiseContinuation, this);
+	if (error != JsNoError)
+		throw std::runtime_error("API Failure: JsSetPromiseContinuationCallback");
+
+#ifdef JSEXEC_CHAKRACORE
+	error = JsSetHostPromiseRejectionTracker(&EventLoop::OnPromiseRejection, this);
+	if (error != JsNoError)
+		throw std::runtime_error("API Failure: JsSetHostPromiseRejectionTracker");
+#endif
+}
+
+void CALLBACK EventLoop::OnPromiseContinuation(JsValueRef task, void* callbackState)
+{
+	EventLoop& eventLoop = *static_cast<EventLoop*>(callbackState);
+	JsAddRef(task, nullptr);
+	eventLoop.m_jobs.push_back(task);
+}
+
+// Called with handled false when a promise is rejected with no handler, and
+// with handled true if one is attached to it later.
+void CALLBACK EventLoop::OnPromiseRejection(JsValueRef promise, JsValueRef reason, bool handled, void* callbackState)
+{
+	EventLoop& eventLoop = *static_cast<EventLoop*>(callbackState);
+	std::vector<Rejection>& rejections = eventLoop.m_rejections;
+
+	if (!handled)
+	{
+		JsAddRef(promise, nullptr);
+		JsAddRef(reason, nullptr);
+		rejections.push_back(Rejection { promise, reason });
+		return;
+	}
+
+	auto it = std::find_if(rejections.begin(), rejections.end(), [promise](const Rejection& rejection) { return rejection.promise == promise; });
+	if (it != rejections.end())
+	{
+		JsRelease(it->promise, nullptr);
+		JsRelease(it->reason, nullptr);
+		rejections.erase(it);
+	}
+}
+
+void EventLoop::Clear()
+{
+	for (JsValueRef task : m_jobs)
+		JsRelease(task, nullptr);
+	m_jobs.clear();
+
+	for (Rejection& rejection : m_rejections)
+	{
+		JsRelease(rejection.promise, nullptr);
+		JsRelease(rejection.reason, nullptr);
+	}
+	m_rejections.clear();
+
+	for (auto& timer : m_timers)
+		Release(timer.second);
+	m_timers.clear();
+
+	m_schedule = decltype(m_schedule)();
+}
+
+unsigned EventLoop::AddTimer(JsValueRef function, const std::vector<JsValueRef>& arguments, Clock::duration delay, bool repeat)
+{
+	unsigned id = m_nextId++;
+	if (m_nextId == 0)
+		m_nextId = 1;
+
+	Timer& timer = m_timers[id];
+	timer.function = function;
+	timer.arguments = arguments;
+	timer.interval = std::max(delay, Clock::duration::zero());
+	timer.repeat = repeat;
+
+	JsAddRef(timer.function, nullptr);
+	for (JsValueRef argument : timer.arguments)
+		JsAddRef(argument, nullptr);
+
+	Schedule(id, timer, Clock::now() + timer.interval);
+	return id;
+}
+
+unsigned EventLoop::AddTimer(std::function<JsErrorCode()> callback, const std::vector<JsValueRef>& retain, Clock::duration delay)
+{
+	unsigned id = m_nextId++;
+	if (m_nextId == 0)
+		m_nextId = 1;
+
+	Timer& timer = m_timers[id];
+	timer.function = JS_INVALID_REFERENCE;
+	timer.callback = std::move(callback);
+	timer.arguments = retain;
+	timer.interval = std::max(delay, Clock::duration::zero());
+	timer.repeat = false;
+
+	for (JsValueRef value : timer.arguments)
+		JsAddRef(value, nullptr);
+
+	Schedule(id, timer, Clock::now() + timer.interval);
+	return id;
+}
+
+void EventLoop::CancelTimer(unsigned id)
+{
+	auto it = m_timers.find(id);
+	if (it == m_timers.end())
+		return;
+
+	Release(it->second);
+	m_timers.erase(it);
+}
+
+void EventLoop::Schedule(unsigned id, Timer& timer, Clock::time_point due)
+{
+	timer.sequence = m_nextSequence++;
+	m_schedule.push(Entry { due, timer.sequence, id });
+}
+
+void EventLoop::Release(Timer& timer)
+{
+	if (timer.function != JS_INVALID_REFERENCE)
+		JsRelease(timer.function, nullptr);
+	for (JsValueRef argument : timer.arguments)
+		JsRelease(argument, nullptr);
+}
+
+JsErrorCode EventLoop::RunJobs()
+{
+	JsErrorCode error = JsNoError;
+	while (error == JsNoError && !m_jobs.empty())
+	{
+		JsValueRef task = m_jobs.front();
+		m_jobs.pop_front();
+
+		JsValueRef result;
+		error = JsCallFunction(task, &m_undefined, 1, &result);
+		JsRelease(task, nullptr);
+	}
+
+	// Only now can no handler be attached any more.
+	if (error == JsNoError && m_jobs.empty() && !m_rejections.empty())
+		error = ReportRejection();
+
+	return error;
+}
+
+// Sets the oldest unhandled rejection as the exception, the rest are reported
+// by later calls.
+JsErrorCode EventLoop::ReportRejection()
+{
+	Rejection rejection = m_rejections.front();
+	m_rejections.erase(m_rejections.begin());
+
+	std::wstring message(L"Uncaught (in promise) ");
+	JsValueRef reasonString;
+	const wchar_t* wzReason;
+	size_t length;
+	JsErrorCode error = JsConvertValueToString(rejection.reason, &reasonString);
+	if (error == JsNoError)
+		error = Jsrt::StringToPointer(reasonString, &wzReason, &length);
+	if (error == JsNoError)
+		message.append(wzReason, length);
+
+	JsRelease(rejection.promise, nullptr);
+	JsRelease(rejection.reason, nullptr);
+	if (error != JsNoError)
+		return error;
+
+	JsValueRef messageValue;
+	JsValueRef errorValue;
+	error = Jsrt::PointerToString(message.c_str(), message.length(), &messageValue);
+	if (error == JsNoError)
+		error = JsCreateError(messageValue, &errorValue);
+	if (error == JsNoError)
+		error = JsSetException(errorValue);
+
+	return error == JsNoError ? JsErrorScriptException : error;
+}
+
+JsErrorCode EventLoop::RunDueTimers()
+{
+	// Timers scheduled by the callbacks below wait for the next call, so a
+	// zero delay interval can't keep us here forever.
+	const unsigned long long sequenceLimit = m_nextSequence;
+	const Clock::time_point now = Clock::now();
+
+	JsErrorCode error = JsNoError;
+	while (error == JsNoError && !m_schedule.empty() && m_schedule.top().due <= now && m_schedule.top().sequence < sequenceLimit)
+	{
+		Entry entry = m_schedule.top();
+		m_schedule.pop();
+
+		auto it = m_timers.find(entry.id);
+		if (it == m_timers.end() || it->second.sequence != entry.sequence)
+			continue;
+
+		std::vector<JsValueRef> arguments;
+		arguments.reserve(it->second.arguments.size() + 1);
+		arguments.push_back(m_undefined);
+		arguments.insert(arguments.end(), it->second.arguments.begin(), it->second.arguments.end());
+		JsValueRef function = it->second.function;
+
+		// One-shot timers are done before their callback runs, like in a browser.
+		// Keep the references until the call returns.
+		Timer finished {};
+		bool oneShot = !it->second.repeat;
+		if (oneShot)
+		{
+			finished = std::move(it->second);
+			m_timers.erase(it);
+		}
+		else
+		{
+			Schedule(entry.id, it->second, std::max(entry.due + it->second.interval, now));
+		}
+
+		JsValueRef result;
+		if (finished.callback)
+			error = finished.callback();
+		else
+			error = JsCallFunction(function, arguments.data(), static_cast<unsigned short>(arguments.size()), &result);
+		if (oneShot)
+			Release(finished);
+
+		if (error == JsNoError)
+			error = RunJobs();
+	}
+
+	return error;
+}
+
+bool EventLoop::NextDue(Clock::time_point& due)
+{
+	while (!m_schedule.empty())
+	{
+		const Entry& entry = m_schedule.top();
+		auto it = m_timers.find(entry.id);
+		if (it != m_timers.end() && it->second.sequence == entry.sequence)
+		{
+			due = entry.due;
+			return true;
+		}
+		m_schedule.pop();
+	}
+
+	return false;
+}
+
+}
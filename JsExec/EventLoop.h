@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "JsrtCompat.h"
+
+namespace JsWrapper
+{
+
+// Promise jobs and timers for one context. Promise jobs (microtasks) run to
+// completion after each script or timer callback; timers only run when the
+// host pumps them, so sleeping scripts don't hold a thread.
+//
+// On ChakraCore rejections are tracked too: a promise still rejected without
+// a handler once the jobs have run is reported like an uncaught exception.
+// Edge mode JSRT has no rejection tracker, there they go unreported.
+//
+// Every method must be called on the runtime's thread with the context current.
+class EventLoop
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	EventLoop() = default;
+
+	// Installs the promise continuation callback (and rejection tracker) for the current context.
+	// undefined is the context's undefined value, passed as 'this' to callbacks.
+	void Attach(JsValueRef undefined);
+
+	// Releases all queued jobs and timers. Call before the runtime is disposed.
+	void Clear();
+
+	// Returns the timer id. Takes a reference on function and arguments until the timer is done.
+	unsigned AddTimer(JsValueRef function, const std::vector<JsValueRef>& arguments, Clock::duration delay, bool repeat);
+
+	// A one-shot timer running host code, e.g. to step work the host does on
+	// script's behalf. The values in retain are kept alive until it has run.
+	// callback must not throw, its error stops RunDueTimers like a script's.
+	unsigned AddTimer(std::function<JsErrorCode()> callback, const std::vector<JsValueRef>& retain, Clock::duration delay);
+	void CancelTimer(unsigned id);
+
+	// Both stop at the first callback that throws and return its error, the
+	// exception is left for the caller to collect. Everything else stays queued.
+	// An unhandled rejection is such an error too, once no jobs are left: an
+	// Error whose message starts "Uncaught (in promise)".
+	JsErrorCode RunJobs();
+	JsErrorCode RunDueTimers();
+
+	// False if no timers are pending.
+	bool NextDue(Clock::time_point& due);
+
+private:
+	struct Timer
+	{
+		JsValueRef function; // JS_INVALID_REFERENCE for a host timer
+		std::function<JsErrorCode()> callback;
+		std::vector<JsValueRef> arguments; // retained values for a host timer
+		Clock::duration interval;
+		bool repeat;
+		unsigned long long sequence; // identifies the heap entry that is current for this timer
+	};
+
+	struct Entry
+	{
+		Clock::time_point due;
+		unsigned long long sequence;
+		unsigned id;
+		bool operator>(const Entry& other) const { return due != other.due ? due > other.due : sequence > other.sequence; }
+	};
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	struct Rejection
+	{
+		JsValueRef promise;
+		JsValueRef reason;
+	};
+
+	static void CALLBACK OnPromiseContinuation(JsValueRef task, void* callbackState);
+	static void CALLBACK OnPromiseRejection(JsValueRef promise, JsValueRef reason, bool handled, void* callbackState);
+	JsErrorCode ReportRejection();
+	void Schedule(unsigned id, Timer& timer, Clock::time_point due);
+	static void Release(Timer& timer);
+
+	JsValueRef m_undefined { JS_INVALID_REFERENCE };
+	std::deque<JsValueRef> m_jobs;
+	std::vector<Rejection> m_rejections; // oldest first, each retained
+	std::unordered_map<unsigned, Timer> m_timers;
+	// Cancelled and rescheduled timers leave stale entries behind, skipped by sequence.
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_schedule;
+	unsigned m_nextId { 1 };
+	unsigned long long m_nextSequence { 0 };
+};
+
+}
@@ -1,9 +1,22 @@
 #include "pch.h"
 #include "JsWrapper.h"
 
-#define USE_EDGEMODE_JSRT
-#include<jsrt.h>
-
+#include "JsrtCompat.h"
+#include "BytecodeCache.h"
+#include "CallStats.h"
+#include "ContextCache.h"
+#include "EventLoop.h"
+#include "MappedFile.h"
+#include "NativeBinding.h"
+#include "SamplingProfiler.h"
+#include "Timeline.h"
+#include "Tracer.h"
+#include "Watchdog.h"
+
+#include<algorithm>
+#include<atomic>
+#include<cmath>
+#include<functional>
 #include<assert.h>
 
 #define ThrowIfFalse(x) do { bool res = x; if (!res) { __debugbreak(); throw std::runtime_error("Assertion Failure: #x"); } } while(false);
@@ -11,233 +24,811 @@
 #define Assert(x) do { JsErrorCode jsLastError = x; assert(jsLastError == JsNoError); } while(false);
 
 using JsWrapper::IExecutionContext;
+namespace Binding = JsWrapper::Binding;
+
+// Wraps a GlobalFunctions member in a JsNativeFunction thunk, see NativeBinding.h.
+#define BindGlobal(fn, wzName, wzHelpText) Binding::Define<decltype(&fn), &fn>(wzName, wzHelpText)
 
 struct GlobalFunctions
 {
-	struct FunctionDefinition
+	using FunctionDefinition = Binding::FunctionDefinition;
+
+	static void Foobar(IExecutionContext& executionContext)
 	{
-		const wchar_t* wzName;
-		JsNativeFunction function;
-		const wchar_t* wzHelpText;
-		FunctionDefinition(const wchar_t* wzN, JsNativeFunction fn, const wchar_t* wzH) : wzName(wzN), function(fn), wzHelpText(wzH) {}
-	};
+		executionContext.Console().Append(L"Hello World");
+	}
 
-	// We can't throw exceptions back to the JS API so add this layer of protection
-	static JsValueRef SafeAPI(const wchar_t* wzName, _In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState, std::function<void(IExecutionContext&)> fn)
+	static void ConsoleLog(IExecutionContext& executionContext, Binding::Rest values)
 	{
-		if (!callbackState)
+		JsWrapper::IConsole& console = executionContext.Console();
+		for (unsigned short i = 0; i < values.count; i++)
 		{
-			assert(false);
-			return nullptr;
-		}
+			JsValueRef stringValue;
+			ThrowIfFailed(JsConvertValueToString(values.pValues[i], &stringValue));
+
+			if (console.WantsUtf8())
+			{
+				const char* szString;
+				size_t length;
+				ThrowIfFailed(JsWrapper::Jsrt::StringToUtf8(stringValue, &szString, &length));
 
-		JsWrapper::IExecutionContext& executionContext = *static_cast<JsWrapper::IExecutionContext*>(callbackState);
+				console.AppendUtf8(JsWrapper::Utf8View(szString, length));
+				continue;
+			}
 
-		try
-		{
-			fn(executionContext);
-		}
-		catch (...)
-		{
-			executionContext.Console().Append(std::wstring(wzName) + L"failed");
-		}
+			const wchar_t *wzString;
+			size_t length;
+			ThrowIfFailed(JsWrapper::Jsrt::StringToPointer(stringValue, &wzString, &length));
 
-		return nullptr;
+			console.Append(JsWrapper::StringView(wzString, length));
+		}
 	}
 
-	static JsValueRef CALLBACK Foobar(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState)
+	// Returns a promise resolved after n milliseconds. Nothing blocks, the
+	// runtime thread keeps running other work in the meantime.
+	static Binding::Promise Sleep(IExecutionContext& executionContext, int milliseconds)
 	{
-		return SafeAPI(L"foobar", callee, isConstructCall, arguments, argumentCount, callbackState, [] (IExecutionContext& executionContext) {
-			std::wstring message = L"Hello World";
-			executionContext.Console().Append(message);
-		});
+		JsValueRef promise, resolve, reject;
+		ThrowIfFailed(JsWrapper::Jsrt::CreatePromise(&promise, &resolve, &reject));
+		executionContext.Events().AddTimer(resolve, {}, std::chrono::milliseconds(std::max(milliseconds, 0)), false);
+		return Binding::Promise { promise };
 	}
 
-	static JsValueRef CALLBACK ConsoleLog(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState)
+	static int AddTimer(IExecutionContext& executionContext, Binding::Function callback, Binding::Optional<double> milliseconds, Binding::Rest arguments, bool repeat)
 	{
-		return SafeAPI(L"console_log", callee, isConstructCall, arguments, argumentCount, callbackState, [argumentCount, arguments] (IExecutionContext& executionContext) {
-			for (unsigned int i = 1; i < argumentCount; i++)
-			{
-				JsValueRef stringValue;
-				ThrowIfFailed(JsConvertValueToString(arguments[i], &stringValue));
-
-				const wchar_t *wzString;
-				size_t length;
-				ThrowIfFailed(JsStringToPointer(stringValue, &wzString, &length));
+		// Anything past the delay is passed on to the callback.
+		std::vector<JsValueRef> callbackArguments(arguments.pValues, arguments.pValues + arguments.count);
 
-				std::wstring message(wzString);
-				executionContext.Console().Append(message);
-			}
-		});
+		auto delay = std::chrono::duration<double, std::milli>(milliseconds.value > 0 ? milliseconds.value : 0);
+		unsigned id = executionContext.Events().AddTimer(callback.value, callbackArguments, std::chrono::duration_cast<JsWrapper::EventLoop::Clock::duration>(delay), repeat);
+		return static_cast<int>(id);
 	}
 
-	static JsValueRef CALLBACK Sleep(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState)
+	static int SetTimeout(IExecutionContext& executionContext, Binding::Function callback, Binding::Optional<double> milliseconds, Binding::Rest arguments)
 	{
-		return SafeAPI(L"sleep", callee, isConstructCall, arguments, argumentCount, callbackState, [argumentCount, arguments] (IExecutionContext& executionContext) {
-			ThrowIfFalse(argumentCount == 2);
-
-			JsValueRef numberVal;
-			ThrowIfFailed(JsConvertValueToNumber(arguments[1], &numberVal));
-			int milliseconds;
+		return AddTimer(executionContext, callback, milliseconds, arguments, false);
+	}
 
-			ThrowIfFailed(JsNumberToInt(numberVal, &milliseconds));
+	static int SetInterval(IExecutionContext& executionContext, Binding::Function callback, Binding::Optional<double> milliseconds, Binding::Rest arguments)
+	{
+		return AddTimer(executionContext, callback, milliseconds, arguments, true);
+	}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
-		});
+	static void ClearTimer(IExecutionContext& executionContext, int id)
+	{
+		executionContext.Events().CancelTimer(static_cast<unsigned>(id));
 	}
 
-	static JsValueRef CALLBACK SetColor(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState) noexcept
+	static void SetColor(IExecutionContext& executionContext, JsWrapper::StringView color)
 	{
-		return SafeAPI(L"set_color", callee, isConstructCall, arguments, argumentCount, callbackState, [argumentCount, arguments] (IExecutionContext& executionContext) {
-			ThrowIfFalse(argumentCount == 2);
+		executionContext.Console().SetColor(color);
+	}
 
-			JsValueRef stringValue;
-			ThrowIfFailed(JsConvertValueToString(arguments[1], &stringValue));
+	static void SetRotation(IExecutionContext& executionContext, double x, double y, double z)
+	{
+		executionContext.Console().Rotate(x, y, z);
+	}
 
-			const wchar_t *wzString;
-			size_t length;
-			ThrowIfFailed(JsStringToPointer(stringValue, &wzString, &length));
+	struct TimelinePlayback
+	{
+		JsValueRef keyframes; // the Float64Array, read in place every frame
+		JsValueRef resolve;
+		JsValueRef reject;
+		JsWrapper::EventLoop::Clock::time_point start;
+		JsWrapper::EventLoop::Clock::duration frame;
+		uint32_t color;
+		bool colorSent;
+	};
 
-			std::wstring color(wzString);
-			executionContext.Console().SetColor(color);
-		});
+	// Plays a keyframe track (see Timeline) on the host: once a frame the
+	// rotation and color are interpolated and applied without calling back
+	// into script, so a whole animation is one call. The promise resolves
+	// after the last keyframe. Changes script makes to the track meanwhile
+	// show in the frames still to come.
+	static Binding::Promise PlayTimeline(IExecutionContext& executionContext, Binding::Float64Array keyframes, Binding::Optional<double> frameMilliseconds)
+	{
+		JsWrapper::Timeline::Validate(keyframes.pValues, keyframes.count);
+
+		JsValueRef promise;
+		TimelinePlayback playback {};
+		ThrowIfFailed(JsWrapper::Jsrt::CreatePromise(&promise, &playback.resolve, &playback.reject));
+		playback.keyframes = keyframes.value;
+		playback.start = JsWrapper::EventLoop::Clock::now();
+		auto frame = std::chrono::duration<double, std::milli>(frameMilliseconds.value >= 1 ? frameMilliseconds.value : 16);
+		playback.frame = std::chrono::duration_cast<JsWrapper::EventLoop::Clock::duration>(frame);
+
+		ThrowIfFailed(StepTimeline(executionContext, playback));
+		return Binding::Promise { promise };
 	}
 
-	
-	static std::vector<double> ExtractNumbers(JsValueRef* arguments, unsigned short count)
+	// Applies the frame that's due and schedules the next one, or resolves.
+	static JsErrorCode StepTimeline(IExecutionContext& executionContext, TimelinePlayback playback)
 	{
-		std::vector<double> numbers(count);
+		unsigned char* pStorage;
+		unsigned int bytes;
+		JsTypedArrayType arrayType;
+		int elementSize;
+		JsErrorCode error = JsGetTypedArrayStorage(playback.keyframes, &pStorage, &bytes, &arrayType, &elementSize);
+		if (error != JsNoError)
+			return error;
+
+		JsWrapper::Timeline timeline(reinterpret_cast<const double*>(pStorage), bytes / sizeof(double));
+		double elapsedMs = std::chrono::duration<double, std::milli>(JsWrapper::EventLoop::Clock::now() - playback.start).count();
+		JsWrapper::Timeline::Frame frame = timeline.At(elapsedMs);
+
+		JsWrapper::IConsole& console = executionContext.Console();
+		console.Rotate(frame.x, frame.y, frame.z);
+		if (!playback.colorSent || frame.color != playback.color)
+		{
+			wchar_t wzColor[10];
+			JsWrapper::Timeline::FormatColor(frame.color, wzColor);
+			console.SetColor(JsWrapper::StringView(wzColor, 9));
+			playback.color = frame.color;
+			playback.colorSent = true;
+		}
 
-		for (int i = 0; i < count; i++)
+		// Script wrote NaN or Infinity into the track after it was validated,
+		// the end would never come.
+		if (!std::isfinite(timeline.LengthMs()))
+			return RejectTimeline(playback, L"play_timeline expects finite keyframe times");
+
+		JsValueRef undefined;
+		JsValueRef result;
+		if (elapsedMs >= timeline.LengthMs())
 		{
-			JsValueRef valRef;
-			ThrowIfFailed(JsConvertValueToNumber(arguments[i], &valRef));
-			double val;
-			ThrowIfFailed(JsNumberToDouble(valRef, &val));
-			numbers[i] = val;
+			error = JsGetUndefinedValue(&undefined);
+			return error == JsNoError ? JsCallFunction(playback.resolve, &undefined, 1, &result) : error;
 		}
 
-		return numbers;
+		executionContext.Events().AddTimer([&executionContext, playback]()
+		{
+			// Host timers mustn't throw, a failing console rejects the promise instead.
+			try
+			{
+				return StepTimeline(executionContext, playback);
+			}
+			catch (std::exception&)
+			{
+				return RejectTimeline(playback, L"play_timeline failed");
+			}
+		}, { playback.keyframes, playback.resolve, playback.reject }, playback.frame);
+		return JsNoError;
 	}
 
-	static JsValueRef CALLBACK SetRotation(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState)
+	static JsErrorCode RejectTimeline(const TimelinePlayback& playback, const wchar_t* wzMessage)
 	{
-		return SafeAPI(L"set_rotation", callee, isConstructCall, arguments, argumentCount, callbackState, [argumentCount, arguments] (IExecutionContext& executionContext) {
-			ThrowIfFalse(argumentCount == 4);
+		JsValueRef message, error, undefined, result;
+		JsErrorCode jsError = JsWrapper::Jsrt::PointerToString(wzMessage, std::char_traits<wchar_t>::length(wzMessage), &message);
+		if (jsError == JsNoError)
+			jsError = JsCreateError(message, &error);
+		if (jsError == JsNoError)
+			jsError = JsGetUndefinedValue(&undefined);
+		JsValueRef arguments[] = { undefined, error };
+		return jsError == JsNoError ? JsCallFunction(playback.reject, arguments, 2, &result) : jsError;
+	}
 
-			std::vector<double> cords = ExtractNumbers(&arguments[1], argumentCount - 1);
-			assert(cords.size() == 3);
+	// { name: { calls, failures, total_ms, p50_us, p90_us, p99_us, max_us }, ... }
+	// for Execute and every global function, see CallStatistics.
+	static Binding::Object HostStats(IExecutionContext& executionContext)
+	{
+		const struct { const wchar_t* wzName; double scale; } fields[] = {
+			{ L"total_ms", 1e-6 }, { L"p50_us", 1e-3 }, { L"p90_us", 1e-3 }, { L"p99_us", 1e-3 }, { L"max_us", 1e-3 },
+		};
 
-			executionContext.Console().Rotate(cords[0], cords[1], cords[2]);
-		});
+		auto setNumber = [](JsValueRef object, const wchar_t* wzName, double value)
+		{
+			JsPropertyIdRef id;
+			ThrowIfFailed(JsWrapper::Jsrt::GetPropertyIdFromName(wzName, &id));
+			JsValueRef number;
+			ThrowIfFailed(JsDoubleToNumber(value, &number));
+			ThrowIfFailed(JsSetProperty(object, id, number, true));
+		};
+
+		JsValueRef result;
+		ThrowIfFailed(JsCreateObject(&result));
+
+		for (auto& call : executionContext.Statistics().Snapshot())
+		{
+			JsValueRef entry;
+			ThrowIfFailed(JsCreateObject(&entry));
+
+			const unsigned long long durations[] = { call.totalNanoseconds, call.p50Nanoseconds, call.p90Nanoseconds, call.p99Nanoseconds, call.maxNanoseconds };
+			setNumber(entry, L"calls", static_cast<double>(call.calls));
+			setNumber(entry, L"failures", static_cast<double>(call.failures));
+			for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+				setNumber(entry, fields[i].wzName, durations[i] * fields[i].scale);
+
+			JsPropertyIdRef name;
+			ThrowIfFailed(JsWrapper::Jsrt::GetPropertyIdFromName(call.name.c_str(), &name));
+			ThrowIfFailed(JsSetProperty(result, name, entry, true));
+		}
+
+		return Binding::Object { result };
 	}
 
-	static JsValueRef CALLBACK Help(_In_ JsValueRef callee, _In_ bool isConstructCall, _In_ JsValueRef *arguments, _In_ unsigned short argumentCount, _In_opt_ void* callbackState)
+	static void Help(IExecutionContext& executionContext)
 	{
-		return SafeAPI(L"help", callee, isConstructCall, arguments, argumentCount, callbackState, [] (IExecutionContext& executionContext) {
-			executionContext.Console().Append(L"welcome to jsexec\n i speak javascript below\nspecial commands:\n");
+		executionContext.Console().Append(L"welcome to jsexec\n i speak javascript below\nspecial commands:\n");
 
-			for (auto& cmd : GetFunctions())
-				executionContext.Console().Append(L"- " + std::wstring(cmd.wzName) + L": " + cmd.wzHelpText);
-		});
+		for (auto& cmd : GetFunctions())
+			executionContext.Console().Append(L"- " + std::wstring(cmd.wzName) + cmd.signature + L": " + cmd.wzHelpText);
 	}
 
 	static const std::vector<FunctionDefinition>& GetFunctions()
 	{
-		// TODO: This registration should be easier. Need to think of a cleaner way besides code generation.
 		static std::vector<FunctionDefinition> functions {
-			{ L"foobar", &Foobar, L"hello world method" }, 
-			{ L"console_log", &ConsoleLog, L"append to console: console_log(\"Message\")" }, 
-			{ L"sleep", &Sleep, L"sleep for n milliseconds: sleep(100)" }, 
-			{ L"set_color", &SetColor, L"set console color (in hex): set_color(\"#AARRGGBB\")" },
-			{ L"set_rotation", &SetRotation, L"set the console rotation: set_rotation(100, 200, -360)" },
-			{ L"help", &Help, L"you found it" },
+			BindGlobal(Foobar, L"foobar", L"hello world method"),
+			BindGlobal(ConsoleLog, L"console_log", L"append to console: console_log(\"Message\")"),
+			BindGlobal(Sleep, L"sleep", L"resolves after n milliseconds: await sleep(100)"),
+			BindGlobal(SetTimeout, L"setTimeout", L"run a function once after n milliseconds"),
+			BindGlobal(SetInterval, L"setInterval", L"run a function every n milliseconds"),
+			BindGlobal(ClearTimer, L"clearTimeout", L"cancel a timer"),
+			BindGlobal(ClearTimer, L"clearInterval", L"cancel a timer"),
+			BindGlobal(SetColor, L"set_color", L"set console color (in hex): set_color(\"#AARRGGBB\")"),
+			BindGlobal(SetRotation, L"set_rotation", L"set the console rotation in degrees: set_rotation(100, 200, -360)"),
+			BindGlobal(PlayTimeline, L"play_timeline", L"animate from keyframes [ms, x, y, z, 0xAARRGGBB, ...], resolves at the end"),
+			BindGlobal(HostStats, L"host_stats", L"call counts and latencies of every host function"),
+			BindGlobal(Help, L"help", L"you found it"),
 		};
 		return functions;
 	}
+
+	static std::vector<const wchar_t*> GetNames()
+	{
+		std::vector<const wchar_t*> names;
+		names.reserve(GetFunctions().size());
+		for (auto& fn : GetFunctions())
+			names.push_back(fn.wzName);
+		return names;
+	}
 };
 
 namespace JsWrapper
 {
 
-class ChakraExecutionContext : public IExecutionContext
+// Makes a context current on the calling thread for the lifetime of the scope.
+// Wrappers don't keep their context current between calls so they can be
+// created on one thread and used on another (see WrapperPool).
+class ContextScope
 {
 public:
-	ChakraExecutionContext(std::unique_ptr<IConsole>&& psConsole) : m_psConsole(std::move(psConsole)) {}
-	IConsole& Console() override { ThrowIfFalse(m_psConsole != nullptr); return *m_psConsole; }
+	ContextScope(JsContextRef pJsContext)
+	{
+		ThrowIfFailed(JsGetCurrentContext(&m_pPreviousContext));
+		ThrowIfFailed(JsSetCurrentContext(pJsContext));
+	}
+
+	~ContextScope()
+	{
+		Assert(JsSetCurrentContext(m_pPreviousContext));
+	}
 
 private:
-	int m_value { 0 };
-	std::unique_ptr<IConsole> m_psConsole;
+	JsContextRef m_pPreviousContext { JS_INVALID_REFERENCE };
+};
+
+// One context of the runtime with the global functions registered in it, and
+// what belongs to it: its promise jobs and timers and its cached handles. The
+// console and the call statistics are the wrapper's and outlive any context.
+class ScriptContext : public IExecutionContext
+{
+public:
+	ScriptContext(JsRuntimeHandle runtime, IConsole* pConsole, CallStatistics& statistics);
+
+	// Drops the timers and jobs and lets the GC have the context.
+	~ScriptContext();
+
+	IConsole& Console() override { ThrowIfFalse(m_pConsole != nullptr); return *m_pConsole; }
+	EventLoop& Events() override { return m_eventLoop; }
+	CallStatistics& Statistics() override { return m_statistics; }
+
+	JsContextRef Handle() const { return m_pJsContext; }
+	const ContextCache& Cache() const { return m_cache; }
+
+private:
+	ScriptContext(const ScriptContext&) = delete;
+	ScriptContext& operator=(const ScriptContext&) = delete;
+
+	IConsole* m_pConsole;
+	CallStatistics& m_statistics;
+	JsContextRef m_pJsContext { JS_INVALID_REFERENCE };
+	ContextCache m_cache;
+	EventLoop m_eventLoop;
+	std::vector<Binding::CallState> m_callStates; // callbackState of each global function, never reallocated
+};
+
+ScriptContext::ScriptContext(JsRuntimeHandle runtime, IConsole* pConsole, CallStatistics& statistics) : m_pConsole(pConsole), m_statistics(statistics)
+{
+	// Held by reference, it isn't always current
+	ThrowIfFailed(JsCreateContext(runtime, &m_pJsContext));
+	ThrowIfFailed(JsAddRef(m_pJsContext, nullptr));
+	ContextScope scope(m_pJsContext);
+
+	// Intern everything registration and error handling will need in one pass
+	const std::vector<Binding::FunctionDefinition>& functions = GlobalFunctions::GetFunctions();
+	ThrowIfFailed(m_cache.Build(GlobalFunctions::GetNames()));
+
+	// Register function(s)
+	m_callStates.reserve(functions.size());
+	for (size_t i = 0; i < functions.size(); i++)
+	{
+		m_callStates.push_back(Binding::CallState { this, &functions[i], &m_statistics.Function(i) });
+
+		JsValueRef jsFunc;
+		ThrowIfFailed(JsCreateFunction(functions[i].function, &m_callStates.back(), &jsFunc));
+		ThrowIfFailed(JsSetProperty(m_cache.Global(), m_cache.Interned(i), jsFunc, true));
+	}
+
+	m_eventLoop.Attach(m_cache.Undefined());
+}
+
+ScriptContext::~ScriptContext()
+{
+	ContextScope scope(m_pJsContext);
+	m_eventLoop.Clear();
+	m_cache.Release();
+	Assert(JsRelease(m_pJsContext, nullptr));
+}
+
+// The runtime and what belongs to it rather than to any one context: the GC
+// heap and its memory accounting, the watchdog registration and the bytecode
+// cache. Its wrappers keep it alive; CreateInstance makes one per wrapper,
+// CreateRuntime one to be shared.
+class ChakraRuntime : public IJsRuntime, public std::enable_shared_from_this<ChakraRuntime>
+{
+public:
+	// Updated from the allocation callback, which the engine may also call from its GC threads.
+	struct MemoryCounters
+	{
+		std::atomic<size_t> current { 0 };
+		std::atomic<size_t> peak { 0 };
+		std::atomic<size_t> executePeak { 0 };
+		std::atomic<unsigned long long> failedAllocations { 0 };
+	};
+
+	explicit ChakraRuntime(const Settings& settings);
+	~ChakraRuntime();
+
+	std::unique_ptr<IJsWrapper> CreateWrapper(std::unique_ptr<IConsole>&& psConsole) override;
+	MemoryUsage GetMemoryUsage() const override;
+
+	JsRuntimeHandle Handle() const { return m_pJsRuntimeHandle; }
+	const Settings& GetSettings() const { return m_settings; }
+	MemoryCounters& Memory() { return m_memory; }
+	Watchdog& GetWatchdog() { return *m_psWatchdog; }
+	Watchdog::Id WatchdogId() const { return m_watchdogId; }
+	BytecodeCache* GetBytecodeCache() const { return m_psBytecodeCache.get(); }
+
+private:
+	ChakraRuntime(const ChakraRuntime&) = delete;
+	ChakraRuntime& operator=(const ChakraRuntime&) = delete;
+
+	static bool CALLBACK OnMemoryEvent(void* callbackState, JsMemoryEventType allocationEvent, size_t allocationSize);
+
+	const Settings m_settings;
+	MemoryCounters m_memory;
+
+	std::shared_ptr<Watchdog> m_psWatchdog;
+	Watchdog::Id m_watchdogId { 0 };
+
+	JsRuntimeHandle m_pJsRuntimeHandle { nullptr };
+
+	std::unique_ptr<BytecodeCache> m_psBytecodeCache;
 };
 
 class ChakraWrapper : public IJsWrapper
 {
 public:
-	ChakraWrapper(std::unique_ptr<IConsole>&& psConsole);
+	ChakraWrapper(const std::shared_ptr<ChakraRuntime>& psRuntime, std::unique_ptr<IConsole>&& psConsole);
 	~ChakraWrapper();
 
 	void Execute(const std::wstring code) override;
+	void ExecuteFile(const std::wstring& path) override;
+	void ExecuteUtf8(std::string code) override;
+	void ExecuteProfiled(const std::wstring code, SamplingProfile& profile) override;
+	void StartProfiling(SamplingProfile& profile) override;
+	void StopProfiling() override;
+	bool RunTimers(std::chrono::steady_clock::time_point& nextDue) override;
+	MemoryUsage GetMemoryUsage() const override;
+	std::vector<CallStats> GetCallStats() const override;
+	BytecodeCacheStats GetBytecodeCacheStats() const override;
+	void Cancel() override;
+	void ResetContext() override;
+	void RunIdleTasks() override;
 
 private:
-	void RegisterGlobalFunction(const wchar_t* wzName, JsNativeFunction function);
+	std::unique_ptr<ScriptContext> CreateContext();
+	void Run(const std::function<JsErrorCode()>& runScript);
+	void RecycleIfGrown();
+	void DisposeRetiredContexts();
+	void DropCancelledWork();
+	void ThrowIfCancelledBeforeArmed(Watchdog::Scope& watch);
+	void ThrowIfScriptError(JsErrorCode scriptError, Watchdog::Outcome outcome = Watchdog::Outcome::Completed);
 	void GetAndThrowException();
 
-	JsRuntimeHandle m_pJsRuntimeHandle { nullptr };
-	JsContextRef m_pJsContext { nullptr };
+	const std::shared_ptr<ChakraRuntime> m_psRuntime;
+	ChakraRuntime::MemoryCounters& m_memory; // the runtime's, so shared with its other wrappers
+	size_t m_contextBaseline { 0 };          // m_memory.current when the context went into use
+	std::atomic<unsigned long long> m_contextResets { 0 };
+
+	std::atomic<unsigned> m_cancelRequests { 0 };
+	unsigned m_cancelsHandled { 0 }; // runtime thread only
+
 	JsValueRef m_result;
-	ChakraExecutionContext m_executionContext;
+	std::unique_ptr<IConsole> m_psConsole;
+	CallStatistics m_statistics;
+
+	// Scripts run in m_psContext. ResetContext swaps in the spare and retires
+	// the old one. The next Execute or RunTimers disposes retired contexts,
+	// RunIdleTasks also collects them and builds the spare.
+	std::unique_ptr<ScriptContext> m_psContext;
+	std::unique_ptr<ScriptContext> m_psSpareContext;
+	std::vector<std::unique_ptr<ScriptContext>> m_retiredContexts;
+
+	std::unique_ptr<SamplingProfiler> m_psProfiler; // between StartProfiling and StopProfiling
 };
 
 std::unique_ptr<IJsWrapper> CreateInstance(std::unique_ptr<IConsole>&& psConsole)
 {
-	return std::make_unique<ChakraWrapper>(std::move(psConsole));
+	return CreateInstance(std::move(psConsole), Settings());
 }
 
-ChakraWrapper::ChakraWrapper(std::unique_ptr<IConsole>&& psConsole) : m_executionContext(std::move(psConsole))
+std::unique_ptr<IJsWrapper> CreateInstance(std::unique_ptr<IConsole>&& psConsole, const Settings& settings)
 {
-	// Initialize JS engine
-	ThrowIfFailed(JsCreateRuntime(JsRuntimeAttributeNone, nullptr, &m_pJsRuntimeHandle));
+	return std::make_shared<ChakraRuntime>(settings)->CreateWrapper(std::move(psConsole));
+}
 
-	// Create & set an execution context
-	ThrowIfFailed(JsCreateContext(m_pJsRuntimeHandle, &m_pJsContext));
-	ThrowIfFailed(JsSetCurrentContext(m_pJsContext));
+std::shared_ptr<IJsRuntime> CreateRuntime(const Settings& settings)
+{
+	return std::make_shared<ChakraRuntime>(settings);
+}
 
-	// Register function(s)
-	for (auto& fn : GlobalFunctions::GetFunctions())
-	{
-		RegisterGlobalFunction(fn.wzName, fn.function);
-	}
+ChakraRuntime::ChakraRuntime(const Settings& settings) : m_settings(settings)
+{
+	// Initialize JS engine, interruptible so the watchdog can stop runaway scripts
+	ThrowIfFailed(JsCreateRuntime(JsRuntimeAttributeAllowScriptInterrupt, nullptr, &m_pJsRuntimeHandle));
+	ThrowIfFailed(JsSetRuntimeMemoryAllocationCallback(m_pJsRuntimeHandle, &m_memory, &ChakraRuntime::OnMemoryEvent));
+	if (m_settings.memoryLimit != 0)
+		ThrowIfFailed(JsSetRuntimeMemoryLimit(m_pJsRuntimeHandle, m_settings.memoryLimit));
+	m_psWatchdog = Watchdog::Shared();
+	m_watchdogId = m_psWatchdog->Register(m_pJsRuntimeHandle);
+
+	if (!m_settings.bytecodeCacheDirectory.empty())
+		m_psBytecodeCache = std::make_unique<BytecodeCache>(m_settings.bytecodeCacheDirectory);
 }
 
-void ChakraWrapper::RegisterGlobalFunction(const wchar_t* wzName, JsNativeFunction function)
+ChakraRuntime::~ChakraRuntime()
 {
-	JsValueRef global;
-	ThrowIfFailed(JsGetGlobalObject(&global));
+	m_psWatchdog->Unregister(m_watchdogId);
+	Assert(JsSetCurrentContext(JS_INVALID_REFERENCE));
+	Assert(JsDisposeRuntime(m_pJsRuntimeHandle));
+}
 
-	JsValueRef jsFunc;
-	ThrowIfFailed(JsCreateFunction(function, &m_executionContext, &jsFunc));
+std::unique_ptr<IJsWrapper> ChakraRuntime::CreateWrapper(std::unique_ptr<IConsole>&& psConsole)
+{
+	return std::make_unique<ChakraWrapper>(shared_from_this(), std::move(psConsole));
+}
 
-	JsPropertyIdRef funcNameProp;
-	ThrowIfFailed(JsGetPropertyIdFromName(wzName, &funcNameProp));
+MemoryUsage ChakraRuntime::GetMemoryUsage() const
+{
+	MemoryUsage usage;
+	usage.current = m_memory.current.load();
+	usage.peak = m_memory.peak.load();
+	usage.executePeak = m_memory.executePeak.load();
+	usage.limit = m_settings.memoryLimit;
+	usage.failedAllocations = m_memory.failedAllocations.load();
+	return usage;
+}
 
-	ThrowIfFailed(JsSetProperty(global, funcNameProp, jsFunc, true));
+ChakraWrapper::ChakraWrapper(const std::shared_ptr<ChakraRuntime>& psRuntime, std::unique_ptr<IConsole>&& psConsole)
+	: m_psRuntime(psRuntime), m_memory(psRuntime->Memory()), m_psConsole(std::move(psConsole)), m_statistics(GlobalFunctions::GetNames())
+{
+	// Create an execution context, current only while we're using it
+	m_psContext = CreateContext();
+	m_contextBaseline = m_memory.current.load();
+}
+
+std::unique_ptr<ScriptContext> ChakraWrapper::CreateContext()
+{
+	TraceSpan span("script", L"CreateContext");
+	return std::make_unique<ScriptContext>(m_psRuntime->Handle(), m_psConsole.get(), m_statistics);
 }
 
 ChakraWrapper::~ChakraWrapper()
 {
-	Assert(JsSetCurrentContext(JS_INVALID_REFERENCE));
-	Assert(JsDisposeRuntime(m_pJsRuntimeHandle));
+	StopProfiling();
+
+	m_retiredContexts.clear();
+	m_psSpareContext.reset();
+	m_psContext.reset();
 }
 
 void ChakraWrapper::Execute(const std::wstring code)
 {
-	JsSourceContext sourceContext = 0;
-	JsErrorCode scriptError = JsRunScript(code.c_str(), sourceContext, L"", &m_result);
-	
+	Run([this, &code]()
+	{
+		if (BytecodeCache* pBytecodeCache = m_psRuntime->GetBytecodeCache())
+			return pBytecodeCache->Run(code, &m_result);
+
+		JsSourceContext sourceContext = 0;
+		return Jsrt::RunScript(code.c_str(), sourceContext, L"", &m_result);
+	});
+}
+
+void ChakraWrapper::ExecuteFile(const std::wstring& path)
+{
+	std::unique_ptr<MappedFile> psSource = MappedFile::Open(path);
+	if (!psSource)
+		throw std::runtime_error("Unable to map " + Jsrt::ToUtf8(path.c_str(), path.length()));
+
+	Run([this, &psSource, &path]()
+	{
+		JsSourceContext sourceContext = 0;
+		return Jsrt::RunMappedScript(std::move(psSource), sourceContext, path.c_str(), &m_result);
+	});
+}
+
+void ChakraWrapper::ExecuteUtf8(std::string code)
+{
+	Run([this, &code]()
+	{
+		JsSourceContext sourceContext = 0;
+		return Jsrt::RunUtf8Script(std::move(code), sourceContext, L"", &m_result);
+	});
+}
+
+// The part of Execute around running the script: context recycling, cancel
+// and timeout handling, the promise jobs it queued, statistics and tracing.
+void ChakraWrapper::Run(const std::function<JsErrorCode()>& runScript)
+{
+	DisposeRetiredContexts();
+	RecycleIfGrown();
+
+	ContextScope scope(m_psContext->Handle());
+	DropCancelledWork();
+	m_memory.executePeak.store(m_memory.current.load());
+	Watchdog::Scope watch(m_psRuntime->GetWatchdog(), m_psRuntime->WatchdogId(), m_psRuntime->GetSettings().executionTimeout, this);
+	ThrowIfCancelledBeforeArmed(watch);
+	auto start = std::chrono::steady_clock::now();
+
+	JsErrorCode scriptError = runScript();
+	if (scriptError == JsNoError)
+		scriptError = m_psContext->Events().RunJobs();
+
+	auto end = std::chrono::steady_clock::now();
+	m_statistics.Counters(CallStatistics::Execute).Record(end - start, scriptError != JsNoError);
+	if (Tracer::IsEnabled())
+		Tracer::Complete("script", L"Execute", start, end);
+
+	ThrowIfScriptError(scriptError, watch.Finish());
+}
+
+void ChakraWrapper::ExecuteProfiled(const std::wstring code, SamplingProfile& profile)
+{
+	StartProfiling(profile);
+	try
+	{
+		Execute(code);
+	}
+	catch (...)
+	{
+		StopProfiling();
+		throw;
+	}
+	StopProfiling();
+}
+
+void ChakraWrapper::StartProfiling(SamplingProfile& profile)
+{
+	StopProfiling();
+
+	ContextScope scope(m_psContext->Handle());
+	m_psProfiler = std::make_unique<SamplingProfiler>(m_psRuntime->Handle(), profile);
+}
+
+void ChakraWrapper::StopProfiling()
+{
+	if (!m_psProfiler)
+		return;
+
+	ContextScope scope(m_psContext->Handle());
+	m_psProfiler.reset();
+}
+
+bool ChakraWrapper::RunTimers(std::chrono::steady_clock::time_point& nextDue)
+{
+	DisposeRetiredContexts();
+	ContextScope scope(m_psContext->Handle());
+	DropCancelledWork();
+
+	Watchdog::Scope watch(m_psRuntime->GetWatchdog(), m_psRuntime->WatchdogId(), m_psRuntime->GetSettings().executionTimeout, this);
+	ThrowIfCancelledBeforeArmed(watch);
+	JsErrorCode scriptError;
+	{
+		TraceSpan span("script", L"RunTimers");
+		scriptError = m_psContext->Events().RunDueTimers();
+	}
+	ThrowIfScriptError(scriptError, watch.Finish());
+
+	return m_psContext->Events().NextDue(nextDue);
+}
+
+MemoryUsage ChakraWrapper::GetMemoryUsage() const
+{
+	MemoryUsage usage = m_psRuntime->GetMemoryUsage();
+	usage.contextResets = m_contextResets.load();
+	return usage;
+}
+
+std::vector<CallStats> ChakraWrapper::GetCallStats() const
+{
+	return m_statistics.Snapshot();
+}
+
+BytecodeCacheStats ChakraWrapper::GetBytecodeCacheStats() const
+{
+	const BytecodeCache* pBytecodeCache = m_psRuntime->GetBytecodeCache();
+	return pBytecodeCache ? pBytecodeCache->GetStats() : BytecodeCacheStats();
+}
+
+void ChakraWrapper::Cancel()
+{
+	// Counted first, so the work is dropped even if no script is running to stop.
+	m_cancelRequests.fetch_add(1);
+	m_psRuntime->GetWatchdog().Cancel(m_psRuntime->WatchdogId(), this);
+}
+
+void ChakraWrapper::ResetContext()
+{
+	TraceSpan span("script", L"ResetContext");
+
+	// Normally the spare is ready and this is a swap.
+	std::unique_ptr<ScriptContext> psFresh = std::move(m_psSpareContext);
+	if (!psFresh)
+		psFresh = CreateContext();
+
+	m_retiredContexts.push_back(std::move(m_psContext));
+	m_psContext = std::move(psFresh);
+	m_contextBaseline = m_memory.current.load();
+	m_contextResets.fetch_add(1);
+}
+
+void ChakraWrapper::RunIdleTasks()
+{
+	// Retired contexts go first, so the spare doesn't add to the peak.
+	if (!m_retiredContexts.empty())
+	{
+		DisposeRetiredContexts();
+		Assert(JsCollectGarbage(m_psRuntime->Handle()));
+	}
+
+	if (!m_psSpareContext)
+		m_psSpareContext = CreateContext();
+}
+
+// Swaps in a fresh context once the runtime has grown by recycleAfterBytes
+// since the current one went into use. The first check is just a comparison;
+// only then is garbage collected to see whether the growth is live. A context
+// with timers pending is left alone, swapping it would silently drop them.
+// The growth is the whole runtime's, on a shared one the other wrappers' too.
+void ChakraWrapper::RecycleIfGrown()
+{
+	const size_t recycleAfterBytes = m_psRuntime->GetSettings().recycleAfterBytes;
+	if (recycleAfterBytes == 0 || m_memory.current.load() < m_contextBaseline + recycleAfterBytes)
+		return;
+
+	std::chrono::steady_clock::time_point nextDue;
+	if (m_psContext->Events().NextDue(nextDue))
+		return;
+
+	Assert(JsCollectGarbage(m_psRuntime->Handle()));
+	if (m_memory.current.load() < m_contextBaseline + recycleAfterBytes)
+		return;
+
+	// The point is to give the memory back, so the old context goes right away.
+	ResetContext();
+	DisposeRetiredContexts();
+	Assert(JsCollectGarbage(m_psRuntime->Handle()));
+	m_contextBaseline = m_memory.current.load();
+}
+
+// Releases the contexts ResetContext retired. Only while no script runs, i.e.
+// at the start of a call; the GC reclaims them in its own time.
+void ChakraWrapper::DisposeRetiredContexts()
+{
+	if (m_retiredContexts.empty())
+		return;
+
+	TraceSpan span("script", L"DisposeContexts");
+	m_retiredContexts.clear();
+}
+
+// Drops the timers and promise jobs of whatever was cancelled since the last call.
+void ChakraWrapper::DropCancelledWork()
+{
+	unsigned cancelRequests = m_cancelRequests.load();
+	if (cancelRequests == m_cancelsHandled)
+		return;
+
+	m_cancelsHandled = cancelRequests;
+	m_psContext->Events().Clear();
+}
+
+// A Cancel that came after DropCancelledWork but before the watchdog was armed
+// found nothing to stop there. It still belongs to this call, which stops
+// before running anything.
+void ChakraWrapper::ThrowIfCancelledBeforeArmed(Watchdog::Scope& watch)
+{
+	if (m_cancelRequests.load() == m_cancelsHandled)
+		return;
+
+	watch.Finish(); // re-enables the runtime if the Cancel also reached the watchdog
+	m_psContext->Events().Clear();
+	m_cancelsHandled = m_cancelRequests.load();
+	throw JsWrapper::Exception::Cancelled();
+}
+
+bool CALLBACK ChakraRuntime::OnMemoryEvent(void* callbackState, JsMemoryEventType allocationEvent, size_t allocationSize)
+{
+	MemoryCounters& memory = *static_cast<MemoryCounters*>(callbackState);
+
+	auto raise = [](std::atomic<size_t>& peak, size_t value)
+	{
+		size_t previous = peak.load(std::memory_order_relaxed);
+		while (previous < value && !peak.compare_exchange_weak(previous, value, std::memory_order_relaxed))
+		{
+		}
+	};
+
+	switch (allocationEvent)
+	{
+	case JsMemoryAllocate:
+	{
+		size_t current = memory.current.fetch_add(allocationSize, std::memory_order_relaxed) + allocationSize;
+		raise(memory.peak, current);
+		raise(memory.executePeak, current);
+		break;
+	}
+	case JsMemoryFree:
+		memory.current.fetch_sub(allocationSize, std::memory_order_relaxed);
+		break;
+	case JsMemoryFailure:
+		// Follows the JsMemoryAllocate for the same allocation, which didn't happen after all.
+		memory.current.fetch_sub(allocationSize, std::memory_order_relaxed);
+		memory.failedAllocations.fetch_add(1, std::memory_order_relaxed);
+		break;
+	}
+
+	// The limit itself is enforced by the engine (JsSetRuntimeMemoryLimit).
+	return true;
+}
+
+void ChakraWrapper::ThrowIfScriptError(JsErrorCode scriptError, Watchdog::Outcome outcome)
+{
 	if (scriptError == JsNoError)
 		return;
-	
+
+	// Stopped by the watchdog, which has re-enabled the runtime by now. What the
+	// script left queued is abandoned with it.
+	if (outcome != Watchdog::Outcome::Completed && (scriptError == JsErrorScriptTerminated || scriptError == JsErrorInDisabledState))
+	{
+		bool hasException = false;
+		JsValueRef exception;
+		if (JsHasException(&hasException) == JsNoError && hasException)
+			Assert(JsGetAndClearException(&exception));
+
+		m_psContext->Events().Clear();
+		m_cancelsHandled = m_cancelRequests.load();
+
+		if (outcome == Watchdog::Outcome::TimedOut)
+			throw JsWrapper::Exception::Timeout();
+		throw JsWrapper::Exception::Cancelled();
+	}
+
+	// Hitting the memory limit outside of script code, there's no exception object.
+	if (scriptError == JsErrorOutOfMemory)
+		throw JsWrapper::Exception::Script(L"Out of memory");
+
 	ThrowIfFalse(scriptError == JsErrorScriptException || scriptError == JsErrorScriptCompile);
 
 	GetAndThrowException();
@@ -248,17 +839,47 @@ void ChakraWrapper::GetAndThrowException()
 	JsValueRef exception;
 	ThrowIfFailed(JsGetAndClearException(&exception));
 
-	JsPropertyIdRef messageName;
-	ThrowIfFailed(JsGetPropertyIdFromName(L"message", &messageName));
+	// Script can throw anything. Errors are reported by their message, anything
+	// else (throw "x", or an object without one) as the value converted to a string.
+	JsValueType type;
+	ThrowIfFailed(JsGetValueType(exception, &type));
 
-	JsValueRef messageValue;
-	ThrowIfFailed(JsGetProperty(exception, messageName, &messageValue));
+	JsValueRef messageValue = JS_INVALID_REFERENCE;
+	if (type == JsObject || type == JsError || type == JsFunction || type == JsArray)
+	{
+		JsValueType messageType;
+		ThrowIfFailed(JsGetProperty(exception, m_psContext->Cache().Id(ContextCache::Message), &messageValue));
+		ThrowIfFailed(JsGetValueType(messageValue, &messageType));
+		if (messageType != JsString)
+			messageValue = JS_INVALID_REFERENCE;
+	}
+	if (messageValue == JS_INVALID_REFERENCE && JsConvertValueToString(exception, &messageValue) != JsNoError)
+	{
+		// A symbol, or a toString that threw in turn
+		bool hasException = false;
+		JsValueRef nested;
+		if (JsHasException(&hasException) == JsNoError && hasException)
+			Assert(JsGetAndClearException(&nested));
+		throw JsWrapper::Exception::Script(L"Uncaught exception");
+	}
 
 	const wchar_t *wzMessage;
 	size_t length;
-	ThrowIfFailed(JsStringToPointer(messageValue, &wzMessage, &length));
+	ThrowIfFailed(Jsrt::StringToPointer(messageValue, &wzMessage, &length));
 
 	throw JsWrapper::Exception::Script(wzMessage);
 }
 
+void IConsole::AppendUtf8(Utf8View text)
+{
+	Append(Jsrt::FromUtf8(text.Data(), text.Length()));
+}
+
+void RunEventLoop(IJsWrapper& wrapper)
+{
+	std::chrono::steady_clock::time_point nextDue;
+	while (wrapper.RunTimers(nextDue))
+		std::this_thread::sleep_until(nextDue);
+}
+
 }
\ No newline at end of file
@@ -1,22 +1,174 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace JsWrapper
 {
 
 class IExecutionContext;
 class IConsole;
+class EventLoop;
+class CallStatistics;
+class SamplingProfile;
+
+// Memory of a wrapper's runtime in bytes, as reported by the engine's
+// allocation callback.
+struct MemoryUsage
+{
+	size_t current { 0 };
+	size_t peak { 0 };        // highest since the wrapper was created
+	size_t executePeak { 0 }; // highest during the last Execute
+	size_t limit { 0 };       // 0: unlimited
+	unsigned long long failedAllocations { 0 }; // refused, usually because of the limit
+	unsigned long long contextResets { 0 };     // by ResetContext or Settings::recycleAfterBytes
+};
+
+// Counters of a runtime's bytecode cache (Settings::bytecodeCacheDirectory),
+// all zero without one. Only Execute goes through the cache.
+struct BytecodeCacheStats
+{
+	unsigned long long hits { 0 };     // ran bytecode serialized by an earlier run, without parsing
+	unsigned long long misses { 0 };   // parsed, including the run that serialized the script
+	unsigned long long rejected { 0 }; // cache files dropped: corrupt, for another source or engine build
+	unsigned long long writes { 0 };
+};
+
+// Time spent in one host entry point, see CallStatistics. Durations come from
+// a histogram and are exact to within 1/16.
+struct CallStats
+{
+	std::wstring name; // "Execute" or the global function's name
+	unsigned long long calls { 0 };
+	unsigned long long failures { 0 };
+	unsigned long long totalNanoseconds { 0 };
+	unsigned long long p50Nanoseconds { 0 };
+	unsigned long long p90Nanoseconds { 0 };
+	unsigned long long p99Nanoseconds { 0 };
+	unsigned long long maxNanoseconds { 0 };
+};
 
 // Interface to the JavaScript engine for the host app.
-// All interaction with the IJsWrapper must happen on a single thread.
+// Calls into an IJsWrapper must not overlap. They may come from different
+// threads, e.g. a wrapper created by WrapperPool's refill thread.
 class IJsWrapper
 {
 public:
 	virtual ~IJsWrapper() {};
+
+	// Runs the script and the promise jobs it queued.
 	virtual void Execute(const std::wstring code) = 0;
+
+	// Execute for a script file (see Jsrt::DecodeScript for encodings). The
+	// file is memory-mapped and, on ChakraCore, the mapping is the engine's
+	// source, so a large script isn't also held as a std::wstring and copied.
+	// Doesn't go through the bytecode cache. Throws std::runtime_error if the
+	// file can't be mapped, which includes empty files.
+	virtual void ExecuteFile(const std::wstring& path) = 0;
+
+	// Execute for UTF-8 source. On ChakraCore the string itself becomes the
+	// engine's source, moved rather than converted or copied. Doesn't go
+	// through the bytecode cache.
+	virtual void ExecuteUtf8(std::string code) = 0;
+
+	// Execute with the sampling profiler on, adding the JS stacks it sees to
+	// profile (also when the script throws). See SamplingProfiler for the cost.
+	virtual void ExecuteProfiled(const std::wstring code, SamplingProfile& profile) = 0;
+
+	// Keeps the sampling profiler on until StopProfiling, so every Execute and
+	// RunTimers call in between adds to profile, which must outlive it. The
+	// runtime is in debug mode meanwhile (no JIT), for the other wrappers of a
+	// shared runtime too. Replaces a profiler already running.
+	virtual void StartProfiling(SamplingProfile& profile) = 0;
+	virtual void StopProfiling() = 0;
+
+	// Runs the timers (setTimeout, setInterval, sleep) that are due and the
+	// promise jobs they queue. Throws Exception::Script if a callback throws.
+	// Returns false if no timers are left, otherwise when the next one is due.
+	virtual bool RunTimers(std::chrono::steady_clock::time_point& nextDue) = 0;
+
+	// Safe to call from any thread.
+	virtual MemoryUsage GetMemoryUsage() const = 0;
+
+	// Safe to call from any thread. Execute first, then every global function.
+	virtual std::vector<CallStats> GetCallStats() const = 0;
+
+	// Safe to call from any thread. The runtime's, so on a shared one also
+	// counts the other wrappers' scripts.
+	virtual BytecodeCacheStats GetBytecodeCacheStats() const = 0;
+
+	// Safe to call from any thread. Stops the Execute or RunTimers call in
+	// progress, which throws Exception::Cancelled, and drops the pending timers
+	// and promise jobs before the next call runs anything.
+	virtual void Cancel() = 0;
+
+	// Continues in a fresh context: globals, timers and promise jobs of earlier
+	// scripts are gone, the console and call statistics stay. Swaps in the spare
+	// context built by RunIdleTasks, or creates one if it isn't ready yet. The
+	// old context is disposed by the next call that runs script, or by
+	// RunIdleTasks, which also has the GC reclaim it.
+	virtual void ResetContext() = 0;
+
+	// Housekeeping kept off Execute: disposes contexts retired by ResetContext
+	// and builds the spare for the next one. Call when idle, e.g. with no work
+	// queued; it's cheap when there's nothing to do.
+	virtual void RunIdleTasks() = 0;
+};
+
+// Optional behavior for an IJsWrapper. Defaults match CreateInstance(psConsole).
+struct Settings
+{
+	// Directory for serialized scripts (see BytecodeCache). Empty disables the cache.
+	std::wstring bytecodeCacheDirectory;
+
+	// Upper bound for the runtime's memory in bytes. Allocations past it fail and
+	// the script gets an out of memory error. 0 means unlimited.
+	size_t memoryLimit { 0 };
+
+	// Longest a single Execute or RunTimers call may run before it's stopped
+	// with Exception::Timeout. 0 means no limit.
+	std::chrono::milliseconds executionTimeout { 0 };
+
+	// Runtime growth in bytes since the context went into use after which
+	// Execute first switches to a fresh one (see IJsWrapper::ResetContext), so
+	// a long session doesn't keep everything its scripts ever left behind.
+	// Contexts with timers pending aren't recycled. 0 never recycles.
+	size_t recycleAfterBytes { 0 };
+};
+
+// One engine runtime shared by several wrappers, each with its own context
+// and console. Sessions are isolated from each other's globals but share the
+// GC heap, the memory limit, the execution timeout and the bytecode cache.
+// Much cheaper per session than a runtime each, for hosts running many small
+// sessions on one thread.
+//
+// The engine binds a runtime to one thread at a time, so calls into all the
+// wrappers of a runtime must not overlap, not just calls into one of them.
+// Cancel is the exception, as ever, and only stops its own wrapper's script.
+class IJsRuntime
+{
+public:
+	virtual ~IJsRuntime() { }
+
+	// The wrapper keeps the runtime alive.
+	virtual std::unique_ptr<IJsWrapper> CreateWrapper(std::unique_ptr<IConsole>&& psConsole) = 0;
+
+	// For the whole runtime. A wrapper reports the same, plus its context resets.
+	virtual MemoryUsage GetMemoryUsage() const = 0;
 };
 
 // Factory method for creating an IJsWrapper.
 std::unique_ptr<IJsWrapper> CreateInstance(std::unique_ptr<IConsole>&& psConsole);
+std::unique_ptr<IJsWrapper> CreateInstance(std::unique_ptr<IConsole>&& psConsole, const Settings& settings);
+
+// Factory method for a runtime to share, see IJsRuntime. recycleAfterBytes
+// then counts the growth of the whole runtime.
+std::shared_ptr<IJsRuntime> CreateRuntime(const Settings& settings = Settings());
+
+// Pumps RunTimers until no timers are left, sleeping while none are due.
+void RunEventLoop(IJsWrapper& wrapper);
 
 
 // Owned by the JavaScript runtime. Used to host any state needed for
@@ -26,6 +178,53 @@ class IExecutionContext
 public:
 	virtual ~IExecutionContext() {};
 	virtual IConsole& Console() = 0;
+	virtual EventLoop& Events() = 0;
+	virtual CallStatistics& Statistics() = 0;
+};
+
+// Non-owning view of a string. Strings handed to IConsole point into the
+// engine's buffer and are only valid for the duration of the call, copy
+// what needs to outlive it. (std::wstring_view isn't available on v140.)
+class StringView
+{
+public:
+	StringView() : m_wzData(L""), m_length(0) { }
+	StringView(const wchar_t* wzData, size_t length) : m_wzData(wzData), m_length(length) { }
+	StringView(const wchar_t* wzData) : m_wzData(wzData), m_length(std::char_traits<wchar_t>::length(wzData)) { }
+	StringView(const std::wstring& str) : m_wzData(str.data()), m_length(str.length()) { }
+
+	const wchar_t* Data() const { return m_wzData; }
+	size_t Length() const { return m_length; }
+	bool Empty() const { return m_length == 0; }
+	wchar_t operator[](size_t index) const { return m_wzData[index]; }
+
+	const wchar_t* begin() const { return m_wzData; }
+	const wchar_t* end() const { return m_wzData + m_length; }
+
+	std::wstring ToString() const { return std::wstring(m_wzData, m_length); }
+
+private:
+	const wchar_t* m_wzData;
+	size_t m_length;
+};
+
+// StringView for UTF-8 text, same lifetime rules.
+class Utf8View
+{
+public:
+	Utf8View() : m_szData(""), m_length(0) { }
+	Utf8View(const char* szData, size_t length) : m_szData(szData), m_length(length) { }
+	Utf8View(const std::string& str) : m_szData(str.data()), m_length(str.length()) { }
+
+	const char* Data() const { return m_szData; }
+	size_t Length() const { return m_length; }
+	bool Empty() const { return m_length == 0; }
+
+	std::string ToString() const { return std::string(m_szData, m_length); }
+
+private:
+	const char* m_szData;
+	size_t m_length;
 };
 
 // Callback site from the JavaScript runtime to the host.
@@ -35,9 +234,17 @@ class IConsole
 {
 public:
 	virtual ~IConsole() {};
-	virtual void Append(const std::wstring text) = 0;
-	virtual void SetColor(const std::wstring hexColorStr) = 0;
+	virtual void Append(StringView text) = 0;
+	virtual void SetColor(StringView hexColor) = 0;
 	virtual void Rotate(double x, double y, double z) = 0;
+
+	// Consoles that write or keep UTF-8 return true, console_log then hands
+	// them its text through AppendUtf8 as the engine's UTF-8 copy, without a
+	// wide string in between.
+	virtual bool WantsUtf8() const { return false; }
+
+	// Append for UTF-8 text. The default converts it and calls Append.
+	virtual void AppendUtf8(Utf8View text);
 };
 
 
@@ -53,6 +260,21 @@ namespace Exception
 	private:
 		std::wstring m_why;
 	};
+
+	// The script was stopped after Settings::executionTimeout. Its pending
+	// timers and promise jobs are dropped, the wrapper stays usable.
+	class Timeout : public Script
+	{
+	public:
+		Timeout() : Script(L"Script timed out") { }
+	};
+
+	// The script was stopped by IJsWrapper::Cancel.
+	class Cancelled : public Script
+	{
+	public:
+		Cancelled() : Script(L"Script cancelled") { }
+	};
 }
 
 }
\ No newline at end of file
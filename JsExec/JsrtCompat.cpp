@@ -0,0 +1,462 @@
+#include "pch.h"
+#include "JsrtCompat.h"
+
+#include <climits>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace
+{
+	const char32_t kReplacementCharacter = 0xFFFD;
+
+	// Decodes one code point from a wchar_t string, which is UTF-16 on Windows and UTF-32 elsewhere.
+	char32_t DecodeWide(const wchar_t* wzString, size_t length, size_t& i)
+	{
+		char32_t ch = static_cast<char32_t>(wzString[i++]);
+		if (sizeof(wchar_t) == 2 && ch >= 0xD800 && ch <= 0xDBFF)
+		{
+			if (i < length)
+			{
+				char32_t low = static_cast<char32_t>(wzString[i]);
+				if (low >= 0xDC00 && low <= 0xDFFF)
+				{
+					i++;
+					return 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
+				}
+			}
+			return kReplacementCharacter;
+		}
+		return ch;
+	}
+
+	void AppendWide(std::wstring& str, char32_t ch)
+	{
+		if (sizeof(wchar_t) == 2 && ch >= 0x10000)
+		{
+			ch -= 0x10000;
+			str.push_back(static_cast<wchar_t>(0xD800 + (ch >> 10)));
+			str.push_back(static_cast<wchar_t>(0xDC00 + (ch & 0x3FF)));
+		}
+		else
+		{
+			str.push_back(static_cast<wchar_t>(ch));
+		}
+	}
+
+	bool HasUtf8Bom(const unsigned char* pBytes, size_t length)
+	{
+		return length >= 3 && pBytes[0] == 0xEF && pBytes[1] == 0xBB && pBytes[2] == 0xBF;
+	}
+
+	bool HasUtf16Bom(const unsigned char* pBytes, size_t length)
+	{
+		return length >= 2 && pBytes[0] == 0xFF && pBytes[1] == 0xFE;
+	}
+}
+
+namespace JsWrapper
+{
+namespace Jsrt
+{
+
+std::string ToUtf8(const wchar_t* wzString, size_t length)
+{
+	std::string str;
+	AppendUtf8(wzString, length, str);
+	return str;
+}
+
+void AppendUtf8(const wchar_t* wzString, size_t length, std::string& str)
+{
+	str.reserve(str.length() + length);
+
+	for (size_t i = 0; i < length;)
+	{
+		char32_t ch = DecodeWide(wzString, length, i);
+		if (ch < 0x80)
+		{
+			str.push_back(static_cast<char>(ch));
+		}
+		else if (ch < 0x800)
+		{
+			str.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+			str.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+		}
+		else if (ch < 0x10000)
+		{
+			str.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+			str.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+			str.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+		}
+		else
+		{
+			str.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+			str.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+			str.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+			str.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+		}
+	}
+}
+
+std::wstring FromUtf8(const char* szString, size_t length)
+{
+	std::wstring str;
+	str.reserve(length);
+
+	const unsigned char* pBytes = reinterpret_cast<const unsigned char*>(szString);
+	for (size_t i = 0; i < length;)
+	{
+		unsigned char lead = pBytes[i++];
+		size_t trailing = 0;
+		char32_t ch;
+
+		if (lead < 0x80)
+			ch = lead;
+		else if ((lead & 0xE0) == 0xC0)
+			ch = lead & 0x1F, trailing = 1;
+		else if ((lead & 0xF0) == 0xE0)
+			ch = lead & 0x0F, trailing = 2;
+		else if ((lead & 0xF8) == 0xF0)
+			ch = lead & 0x07, trailing = 3;
+		else
+		{
+			AppendWide(str, kReplacementCharacter);
+			continue;
+		}
+
+		bool valid = (i + trailing <= length);
+		for (size_t t = 0; valid && t < trailing; t++)
+		{
+			if ((pBytes[i + t] & 0xC0) != 0x80)
+				valid = false;
+			else
+				ch = (ch << 6) | (pBytes[i + t] & 0x3F);
+		}
+
+		if (!valid)
+		{
+			AppendWide(str, kReplacementCharacter);
+			continue;
+		}
+
+		i += trailing;
+		AppendWide(str, ch);
+	}
+
+	return str;
+}
+
+std::wstring DecodeScript(const unsigned char* pBytes, size_t length)
+{
+	if (HasUtf8Bom(pBytes, length))
+		return FromUtf8(reinterpret_cast<const char*>(pBytes) + 3, length - 3);
+	if (!HasUtf16Bom(pBytes, length))
+		return FromUtf8(reinterpret_cast<const char*>(pBytes), length);
+
+	std::wstring str;
+	str.reserve(length / 2);
+	for (size_t i = 2; i + 1 < length; i += 2)
+	{
+		char32_t ch = pBytes[i] | (pBytes[i + 1] << 8);
+		if (sizeof(wchar_t) == 4 && ch >= 0xD800 && ch <= 0xDBFF && i + 3 < length)
+		{
+			char32_t low = pBytes[i + 2] | (pBytes[i + 3] << 8);
+			if (low >= 0xDC00 && low <= 0xDFFF)
+			{
+				ch = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+		str.push_back(static_cast<wchar_t>(ch));
+	}
+	return str;
+}
+
+#ifdef JSEXEC_CHAKRACORE
+
+namespace
+{
+	std::vector<uint16_t> ToUtf16(const wchar_t* wzString, size_t length)
+	{
+		std::vector<uint16_t> utf16;
+		utf16.reserve(length);
+
+		for (size_t i = 0; i < length;)
+		{
+			char32_t ch = DecodeWide(wzString, length, i);
+			if (ch >= 0x10000)
+			{
+				ch -= 0x10000;
+				utf16.push_back(static_cast<uint16_t>(0xD800 + (ch >> 10)));
+				utf16.push_back(static_cast<uint16_t>(0xDC00 + (ch & 0x3FF)));
+			}
+			else
+			{
+				utf16.push_back(static_cast<uint16_t>(ch));
+			}
+		}
+
+		return utf16;
+	}
+
+	void CHAKRA_CALLBACK UnmapSource(void* pMapping)
+	{
+		delete static_cast<JsWrapper::MappedFile*>(pMapping);
+	}
+
+	void CHAKRA_CALLBACK FreeSource(void* pSource)
+	{
+		delete static_cast<std::string*>(pSource);
+	}
+}
+
+JsErrorCode PointerToString(const wchar_t* wzString, size_t length, JsValueRef* value)
+{
+	std::vector<uint16_t> utf16 = ToUtf16(wzString, length);
+	return JsCreateStringUtf16(utf16.data(), utf16.size(), value);
+}
+
+JsErrorCode RunScript(const wchar_t* wzScript, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	JsValueRef script;
+	JsErrorCode error = PointerToString(wzScript, std::char_traits<wchar_t>::length(wzScript), &script);
+	if (error != JsNoError)
+		return error;
+
+	JsValueRef sourceUrl;
+	error = PointerToString(wzSourceUrl, std::char_traits<wchar_t>::length(wzSourceUrl), &sourceUrl);
+	if (error != JsNoError)
+		return error;
+
+	return JsRun(script, sourceContext, sourceUrl, JsParseScriptAttributeNone, result);
+}
+
+JsErrorCode RunMappedScript(std::unique_ptr<MappedFile>&& psSource, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	unsigned char* pBytes = psSource->Data();
+	size_t length = psSource->Size();
+	JsParseScriptAttributes attributes = JsParseScriptAttributeNone;
+
+	size_t bom = 0;
+	if (HasUtf8Bom(pBytes, length))
+		bom = 3;
+	else if (HasUtf16Bom(pBytes, length))
+		bom = 2, attributes = JsParseScriptAttributeArrayBufferIsUtf16Encoded;
+
+	if (length - bom > UINT_MAX)
+		return JsErrorInvalidArgument;
+
+	JsValueRef sourceUrl;
+	JsErrorCode error = PointerToString(wzSourceUrl, std::char_traits<wchar_t>::length(wzSourceUrl), &sourceUrl);
+	if (error != JsNoError)
+		return error;
+
+	JsValueRef script;
+	error = JsCreateExternalArrayBuffer(pBytes + bom, static_cast<unsigned int>(length - bom), &UnmapSource, psSource.get(), &script);
+	if (error != JsNoError)
+		return error;
+	psSource.release();
+
+	return JsRun(script, sourceContext, sourceUrl, attributes, result);
+}
+
+JsErrorCode RunUtf8Script(std::string&& code, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	if (code.length() > UINT_MAX)
+		return JsErrorInvalidArgument;
+
+	JsValueRef sourceUrl;
+	JsErrorCode error = PointerToString(wzSourceUrl, std::char_traits<wchar_t>::length(wzSourceUrl), &sourceUrl);
+	if (error != JsNoError)
+		return error;
+
+	// The engine refers to the source after the run (functions are parsed
+	// lazily), so the string lives on the heap until the buffer is collected.
+	std::unique_ptr<std::string> psSource = std::make_unique<std::string>(std::move(code));
+	JsValueRef script;
+	error = JsCreateExternalArrayBuffer(&(*psSource)[0], static_cast<unsigned int>(psSource->length()), &FreeSource, psSource.get(), &script);
+	if (error != JsNoError)
+		return error;
+	psSource.release();
+
+	return JsRun(script, sourceContext, sourceUrl, JsParseScriptAttributeNone, result);
+}
+
+JsErrorCode GetPropertyIdFromName(const wchar_t* wzName, JsPropertyIdRef* propertyId)
+{
+	std::string name = ToUtf8(wzName, std::char_traits<wchar_t>::length(wzName));
+	return JsCreatePropertyId(name.c_str(), name.length(), propertyId);
+}
+
+JsErrorCode CreatePromise(JsValueRef* promise, JsValueRef* resolveFunction, JsValueRef* rejectFunction)
+{
+	return JsCreatePromise(promise, resolveFunction, rejectFunction);
+}
+
+JsErrorCode StringToPointer(JsValueRef value, const wchar_t** wzString, size_t* length)
+{
+	thread_local std::vector<uint16_t> utf16;
+	thread_local std::wstring scratch;
+
+	int stringLength;
+	JsErrorCode error = JsGetStringLength(value, &stringLength);
+	if (error != JsNoError)
+		return error;
+
+	utf16.resize(static_cast<size_t>(stringLength));
+	size_t written = 0;
+	error = JsCopyStringUtf16(value, 0, stringLength, utf16.data(), &written);
+	if (error != JsNoError)
+		return error;
+
+	scratch.clear();
+	for (size_t i = 0; i < written; i++)
+	{
+		char32_t ch = utf16[i];
+		if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < written && utf16[i + 1] >= 0xDC00 && utf16[i + 1] <= 0xDFFF)
+		{
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (utf16[i + 1] - 0xDC00);
+			i++;
+		}
+		AppendWide(scratch, ch);
+	}
+
+	*wzString = scratch.c_str();
+	*length = scratch.length();
+	return JsNoError;
+}
+
+JsErrorCode StringToUtf8(JsValueRef value, const char** szString, size_t* length)
+{
+	thread_local std::string scratch;
+
+	size_t bytes = 0;
+	JsErrorCode error = JsCopyString(value, nullptr, 0, &bytes);
+	if (error != JsNoError)
+		return error;
+
+	scratch.resize(bytes);
+	error = JsCopyString(value, bytes ? &scratch[0] : nullptr, bytes, &bytes);
+	if (error != JsNoError)
+		return error;
+
+	*szString = scratch.data();
+	*length = bytes;
+	return JsNoError;
+}
+
+#else
+
+namespace
+{
+	struct PromiseResolvers
+	{
+		JsValueRef resolveFunction;
+		JsValueRef rejectFunction;
+	};
+
+	// Executor passed to the Promise constructor, runs synchronously inside it.
+	JsValueRef CALLBACK CapturePromiseResolvers(JsValueRef callee, bool isConstructCall, JsValueRef* arguments, unsigned short argumentCount, void* callbackState)
+	{
+		PromiseResolvers& resolvers = *static_cast<PromiseResolvers*>(callbackState);
+		if (argumentCount >= 3)
+		{
+			resolvers.resolveFunction = arguments[1];
+			resolvers.rejectFunction = arguments[2];
+		}
+		return JS_INVALID_REFERENCE;
+	}
+}
+
+JsErrorCode CreatePromise(JsValueRef* promise, JsValueRef* resolveFunction, JsValueRef* rejectFunction)
+{
+	JsValueRef global;
+	JsErrorCode error = JsGetGlobalObject(&global);
+
+	JsPropertyIdRef promiseName;
+	if (error == JsNoError)
+		error = JsGetPropertyIdFromName(L"Promise", &promiseName);
+
+	JsValueRef promiseConstructor;
+	if (error == JsNoError)
+		error = JsGetProperty(global, promiseName, &promiseConstructor);
+
+	PromiseResolvers resolvers { JS_INVALID_REFERENCE, JS_INVALID_REFERENCE };
+	JsValueRef executor;
+	if (error == JsNoError)
+		error = JsCreateFunction(&CapturePromiseResolvers, &resolvers, &executor);
+
+	JsValueRef arguments[2];
+	if (error == JsNoError)
+		error = JsGetUndefinedValue(&arguments[0]);
+
+	if (error == JsNoError)
+	{
+		arguments[1] = executor;
+		error = JsConstructObject(promiseConstructor, arguments, 2, promise);
+	}
+
+	if (error == JsNoError && !resolvers.resolveFunction)
+		error = JsErrorInvalidArgument;
+
+	*resolveFunction = resolvers.resolveFunction;
+	*rejectFunction = resolvers.rejectFunction;
+	return error;
+}
+
+JsErrorCode PointerToString(const wchar_t* wzString, size_t length, JsValueRef* value)
+{
+	return JsPointerToString(wzString, length, value);
+}
+
+JsErrorCode RunScript(const wchar_t* wzScript, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	return JsRunScript(wzScript, sourceContext, wzSourceUrl, result);
+}
+
+JsErrorCode RunMappedScript(std::unique_ptr<MappedFile>&& psSource, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	std::unique_ptr<MappedFile> psMapping = std::move(psSource);
+	std::wstring code = DecodeScript(psMapping->Data(), psMapping->Size());
+	psMapping.reset();
+	return JsRunScript(code.c_str(), sourceContext, wzSourceUrl, result);
+}
+
+JsErrorCode RunUtf8Script(std::string&& code, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result)
+{
+	std::wstring wideCode = FromUtf8(code.data(), code.length());
+	return JsRunScript(wideCode.c_str(), sourceContext, wzSourceUrl, result);
+}
+
+JsErrorCode GetPropertyIdFromName(const wchar_t* wzName, JsPropertyIdRef* propertyId)
+{
+	return JsGetPropertyIdFromName(wzName, propertyId);
+}
+
+JsErrorCode StringToPointer(JsValueRef value, const wchar_t** wzString, size_t* length)
+{
+	return JsStringToPointer(value, wzString, length);
+}
+
+JsErrorCode StringToUtf8(JsValueRef value, const char** szString, size_t* length)
+{
+	thread_local std::string scratch;
+
+	const wchar_t* wzString;
+	size_t wideLength;
+	JsErrorCode error = JsStringToPointer(value, &wzString, &wideLength);
+	if (error != JsNoError)
+		return error;
+
+	scratch.clear();
+	AppendUtf8(wzString, wideLength, scratch);
+	*szString = scratch.data();
+	*length = scratch.length();
+	return JsNoError;
+}
+
+#endif
+
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// Engine selection. The UWP app uses the Edge mode JSRT that ships with Windows,
+// the portable build (CMakeLists.txt) defines JSEXEC_CHAKRACORE and links ChakraCore.
+#ifdef JSEXEC_CHAKRACORE
+#include <ChakraCore.h>
+#else
+#define USE_EDGEMODE_JSRT
+#include <jsrt.h>
+#endif
+
+#include <memory>
+#include <string>
+
+#ifndef _WIN32
+#include <csignal>
+
+#ifndef CALLBACK
+#define CALLBACK CHAKRA_CALLBACK
+#endif
+
+#ifndef __debugbreak
+#ifdef NDEBUG
+#define __debugbreak() ((void)0)
+#else
+#define __debugbreak() std::raise(SIGTRAP)
+#endif
+#endif
+#endif
+
+namespace JsWrapper
+{
+class MappedFile;
+
+namespace Jsrt
+{
+	// The wrapper speaks std::wstring. Edge mode JSRT accepts wchar_t (UTF-16) directly,
+	// ChakraCore on Linux only has UTF-8 and uint16_t entry points and wchar_t is UTF-32,
+	// so these helpers hide the conversion.
+
+	JsErrorCode RunScript(const wchar_t* wzScript, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result);
+	JsErrorCode GetPropertyIdFromName(const wchar_t* wzName, JsPropertyIdRef* propertyId);
+	JsErrorCode PointerToString(const wchar_t* wzString, size_t length, JsValueRef* value);
+
+	// JsCreatePromise on ChakraCore. Edge mode has no such API, there it goes through the global Promise constructor.
+	JsErrorCode CreatePromise(JsValueRef* promise, JsValueRef* resolveFunction, JsValueRef* rejectFunction);
+
+	// On Edge mode this borrows the engine's buffer. On ChakraCore the string is converted
+	// into a per-thread scratch buffer that stays valid until the next call on the same thread.
+	JsErrorCode StringToPointer(JsValueRef value, const wchar_t** wzString, size_t* length);
+
+	// StringToPointer as UTF-8. On ChakraCore the engine writes UTF-8 straight
+	// into a per-thread scratch buffer, on Edge mode it's converted into one.
+	JsErrorCode StringToUtf8(JsValueRef value, const char** szString, size_t* length);
+
+	std::string ToUtf8(const wchar_t* wzString, size_t length);
+	void AppendUtf8(const wchar_t* wzString, size_t length, std::string& utf8);
+	std::wstring FromUtf8(const char* szString, size_t length);
+
+	// Script files are UTF-8, or UTF-16 little endian with a byte order mark.
+	// A UTF-8 byte order mark is skipped.
+	std::wstring DecodeScript(const unsigned char* pBytes, size_t length);
+
+	// RunScript for a mapped file, see DecodeScript. On ChakraCore the mapping
+	// itself becomes the source (an external ArrayBuffer for JsRun) without a
+	// copy on the host side; the engine owns it from then on and unmaps it when
+	// the script is collected. Edge mode has no such API and runs a decoded copy.
+	JsErrorCode RunMappedScript(std::unique_ptr<MappedFile>&& psSource, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result);
+
+	// RunScript for UTF-8 source. On ChakraCore the string is moved into an
+	// external ArrayBuffer for JsRun and freed with it; Edge mode converts it.
+	JsErrorCode RunUtf8Script(std::string&& code, JsSourceContext sourceContext, const wchar_t* wzSourceUrl, JsValueRef* result);
+}
+}
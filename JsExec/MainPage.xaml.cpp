@@ -5,9 +5,14 @@
 
 #include "pch.h"
 #include "MainPage.xaml.h"
+#include "CommandRing.h"
 #include "JsWrapper.h"
+#include "OutputBuffer.h"
+#include "OutputStore.h"
+#include "Tracer.h"
 #include <string>
 #include <functional>
+#include <cstdio>
 #include <ppltasks.h>
 
 using namespace JsExec;
@@ -27,113 +32,281 @@ using namespace Windows::Devices::Enumeration;
 using namespace Windows::System::Threading;
 using namespace Windows::UI::Core;
 
-class Console : public JsWrapper::IConsole
+// Console history kept for the TextBox, older lines are dropped past this.
+static const size_t kOutputCapacityBytes = 4 * 1024 * 1024;
+static const size_t kOutputFlushThresholdChars = 64 * 1024;
+
+// Console text queued between two frames before the runtime thread waits for the UI.
+static const size_t kCommandRingBytes = 1024 * 1024;
+
+// A runaway script gets an out of memory error instead of taking the app down with it.
+static const size_t kScriptMemoryLimit = 512 * 1024 * 1024;
+
+// Past this much growth since the last reset, the next script gets a fresh context.
+static const size_t kContextRecycleBytes = 128 * 1024 * 1024;
+
+// Keeps the console history in an OutputStore and shows its newest lines in the
+// TextBox, so each batch costs the size of the visible text rather than of
+// everything ever logged. Only called on the UI thread.
+class TextBoxSink : public JsWrapper::IOutputSink
 {
 public:
-	Console(TextBox^ pTextBox, MainPage^ pMainPage, CoreDispatcher^ pDispatcher) : m_pTextBody(pTextBox), m_pMainPage(pMainPage), m_pDispatcher(pDispatcher) { }
-	void Append(const std::wstring message) override
+	TextBoxSink(TextBox^ pTextBox, const std::shared_ptr<JsWrapper::OutputStore>& psStore) : m_pTextBody(pTextBox), m_psStore(psStore) { }
+	void Write(const std::wstring& lines, size_t lineCount) override
 	{
-		m_pDispatcher->RunAsync(
-			CoreDispatcherPriority::High,
-			ref new DispatchedHandler([this, message]()
-		{
-			m_pTextBody->Text = m_pTextBody->Text + L"\n" + ref new String(message.c_str());
-		}));
+		m_psStore->AppendLines(lines.c_str(), lines.length());
+
+		uint64_t end = m_psStore->EndLine();
+		m_psStore->CopyLines(end > kVisibleLines ? end - kVisibleLines : 0, end, m_visible);
+		m_pTextBody->Text = ref new String(m_visible.c_str(), static_cast<unsigned int>(m_visible.length()));
 	}
 
-	void SetColor(const std::wstring userHexColorStr) override
-	{
-		// #AARRGGBB or #RRGGBB is expected
-		std::wstring hexColorStr;
+private:
+	static const uint64_t kVisibleLines = 1000;
 
-		// Remove leading # if it's there
-		if (userHexColorStr[0] == L'#')
-		{
-			hexColorStr = userHexColorStr.substr(1, userHexColorStr.length() - 2);
-		}
-		else
-		{
-			hexColorStr = userHexColorStr;
-		}
+	TextBox^ m_pTextBody;
+	std::shared_ptr<JsWrapper::OutputStore> m_psStore;
+	std::wstring m_visible;
+};
 
-		Windows::UI::Color color;
-		color.A = 255;
-		int parsed = 0;
-		if (hexColorStr.length() == 8)
+// #AARRGGBB or #RRGGBB, the # is optional. Throws std::invalid_argument like std::stoi did.
+static Windows::UI::Color ParseColor(JsWrapper::StringView hexColor)
+{
+	// Two hex digits at index.
+	auto parseHexByte = [&hexColor](size_t index)
+	{
+		unsigned value = 0;
+		for (size_t i = index; i < index + 2; i++)
 		{
-			parsed = 2;
-			color.A = std::stoi(hexColorStr.substr(0,2), 0, 16);
+			wchar_t ch = (i < hexColor.Length()) ? hexColor[i] : L'\0';
+			if (ch >= L'0' && ch <= L'9')
+				value = value * 16 + (ch - L'0');
+			else if (ch >= L'a' && ch <= L'f')
+				value = value * 16 + (ch - L'a' + 10);
+			else if (ch >= L'A' && ch <= L'F')
+				value = value * 16 + (ch - L'A' + 10);
+			else
+				throw std::invalid_argument("set_color expects hex digits");
 		}
-		color.R = std::stoi(hexColorStr.substr(parsed, 2), 0, 16);
-		parsed += 2;
-		color.G = std::stoi(hexColorStr.substr(parsed, 2), 0, 16);
+		return static_cast<unsigned char>(value);
+	};
+
+	size_t parsed = 0;
+
+	// Skip leading # if it's there
+	if (!hexColor.Empty() && hexColor[0] == L'#')
+		parsed = 1;
+
+	Windows::UI::Color color;
+	color.A = 255;
+	if (hexColor.Length() - parsed == 8)
+	{
+		color.A = parseHexByte(parsed);
 		parsed += 2;
-		color.B = std::stoi(hexColorStr.substr(parsed, 2), 0, 16);
+	}
+	color.R = parseHexByte(parsed);
+	parsed += 2;
+	color.G = parseHexByte(parsed);
+	parsed += 2;
+	color.B = parseHexByte(parsed);
 
-		m_pDispatcher->RunAsync(
-			CoreDispatcherPriority::High,
-			ref new DispatchedHandler([this, color]()
-		{
-			m_pTextBody->Background = ref new SolidColorBrush(color);
-		}));
+	return color;
+}
+
+// The runtime thread's console. Text goes into the command ring; color and
+// rotation go to the page's latest-wins slots, so they never wait for the UI.
+// Colors are parsed here so a bad one still throws into the script.
+class Console : public JsWrapper::RingConsole
+{
+public:
+	Console(const std::shared_ptr<JsWrapper::CommandRing>& psCommands, MainPage^ pMainPage) : RingConsole(psCommands), m_pMainPage(pMainPage) { }
+
+	void SetColor(JsWrapper::StringView hexColor) override
+	{
+		m_pMainPage->PublishColor(ParseColor(hexColor));
 	}
 
-	void Rotate(double x, double y, double z)
+	void Rotate(double x, double y, double z) override
 	{
-		IAsyncAction^ pAction = m_pDispatcher->RunAsync(CoreDispatcherPriority::High,ref new DispatchedHandler([this, x, y, z]()
-		{
-			PlaneProjection^ pPlaneProjection = ref new PlaneProjection();
-			pPlaneProjection->RotationX = x;
-			pPlaneProjection->RotationY = y;
-			pPlaneProjection->RotationY = z;
-			m_pTextBody->Projection = pPlaneProjection;
-		}));
+		m_pMainPage->PublishRotation(x, y, z);
 	}
 
 private:
-	TextBox^ m_pTextBody;
 	JsExec::MainPage^ m_pMainPage;
-	CoreDispatcher^ m_pDispatcher;
 };
 
-MainPage::MainPage()
+// The UI thread's end of the ring, which only carries text: lines go to the OutputBuffer.
+class FrameConsole : public JsWrapper::IConsole
+{
+public:
+	explicit FrameConsole(JsWrapper::OutputBuffer& output) : m_output(output) { }
+
+	void Append(JsWrapper::StringView message) override
+	{
+		m_output.Append(message.Data(), message.Length());
+	}
+
+	void SetColor(JsWrapper::StringView hexColor) override { }
+	void Rotate(double x, double y, double z) override { }
+
+private:
+	JsWrapper::OutputBuffer& m_output;
+};
+
+// Shows script exceptions in the console. Called on the runtime thread, so the
+// message goes through the ring behind the script's own output.
+static void ReportScriptError(std::exception_ptr error, JsWrapper::CommandRing& commands)
+{
+	if (!error)
+		return;
+
+	try
+	{
+		std::rethrow_exception(error);
+	}
+	catch (JsWrapper::Exception::Cancelled&)
+	{
+		// Reset asked for it, nothing to show.
+	}
+	catch (JsWrapper::Exception::Script& scriptException)
+	{
+		commands.Append(L"Exception:\n" + scriptException.why());
+	}
+}
+
+MainPage::MainPage() : m_frameRequested(false)
 {
 	using JsWrapper::IConsole;
 
 	InitializeComponent();
-	CoreDispatcher^ pDispatcher = CoreWindow::GetForCurrentThread()->Dispatcher;
+	JsWrapper::Tracer::SetThreadName("ui");
+	m_pDispatcher = CoreWindow::GetForCurrentThread()->Dispatcher;
+	m_pConsoleBrush = ref new SolidColorBrush();
+	m_pConsoleProjection = ref new PlaneProjection();
+
+	// Console text is queued by the runtime thread without locking, color and
+	// rotation are published to latest-wins slots. Both are applied once per
+	// frame, where lines are batched into the TextBox rather than set one at a
+	// time. The OutputBuffer is only used on the UI thread.
+	m_psOutputStore = std::make_shared<JsWrapper::OutputStore>(kOutputCapacityBytes);
+	m_psOutput = std::make_shared<JsWrapper::OutputBuffer>(std::make_unique<TextBoxSink>(ConsoleOutput, m_psOutputStore), kOutputFlushThresholdChars);
+	m_psCommands = std::make_shared<JsWrapper::CommandRing>(kCommandRingBytes, [this]()
+	{
+		RequestFrame();
+	});
+	std::shared_ptr<JsWrapper::CommandRing> psCommands = m_psCommands;
+
+	// The pool starts creating a runtime in the background right away, so by the
+	// time the first script runs there's one ready to hand out. The runtime thread
+	// keeps it for good, so no replacement is made; Reset swaps contexts instead.
+	JsWrapper::Settings settings;
+	settings.memoryLimit = kScriptMemoryLimit;
+	settings.recycleAfterBytes = kContextRecycleBytes;
+	m_psWrapperPool = std::make_unique<JsWrapper::WrapperPool>(1, [this, psCommands]() -> std::unique_ptr<IConsole>
+	{
+		return std::make_unique<Console>(psCommands, this);
+	}, settings, JsWrapper::WrapperPool::Refill::Once);
 
-	// Oh my, oh my, a shared_ptr to a unique_ptr? What kind of maddness is this?
-	// There's no R value capture in C++ 11, so a lambda can't take ownership of a unique_ptr.
-	// C++14 will have generalized capture making this possible without the maddness.
-	auto pConsoleWrapper = std::make_shared<std::unique_ptr<IConsole>>(std::make_unique<Console>(ConsoleOutput, this, pDispatcher));
-	ThreadPool::RunAsync(ref new WorkItemHandler([this, pConsoleWrapper](IAsyncAction^ workItem)
+	// All scripts run on this one thread, in the order they were submitted.
+	JsWrapper::WrapperPool* pWrapperPool = m_psWrapperPool.get();
+	m_psRuntimeThread = std::make_unique<JsWrapper::RuntimeThread>([pWrapperPool]()
+	{
+		return pWrapperPool->Acquire();
+	},
+	[psCommands](std::exception_ptr error)
 	{
-		m_pWrapper = JsWrapper::CreateInstance(std::move(*pConsoleWrapper.get()));
+		ReportScriptError(error, *psCommands);
+	});
+}
+
+MainPage::~MainPage()
+{
+	// Nothing drains the ring from here on, a script blocked on a full one would
+	// keep the runtime thread from ever being joined.
+	m_psCommands->Close();
+	m_psRuntimeThread.reset();
+}
+
+void JsExec::MainPage::PublishColor(Windows::UI::Color color)
+{
+	m_backgroundSlot.Publish(Background { color, true });
+	RequestFrame();
+}
+
+void JsExec::MainPage::PublishRotation(double x, double y, double z)
+{
+	m_rotationSlot.Publish(Rotation { x, y, z, true });
+	RequestFrame();
+}
+
+// Any thread. Subscribes to the next Rendering event unless that's already pending,
+// so state set many times between two frames costs one update.
+void JsExec::MainPage::RequestFrame()
+{
+	if (m_frameRequested.exchange(true))
+		return;
+
+	if (JsWrapper::Tracer::IsEnabled())
+		m_frameRequestTime = JsWrapper::Tracer::Clock::now();
+
+	m_pDispatcher->RunAsync(CoreDispatcherPriority::High, ref new DispatchedHandler([this]()
+	{
+		m_renderingToken = CompositionTarget::Rendering += ref new EventHandler<Object^>(this, &MainPage::OnRendering);
 	}));
 }
 
+void JsExec::MainPage::OnRendering(Platform::Object^ sender, Platform::Object^ e)
+{
+	// Only subscribed while there's something to apply, Rendering keeps the
+	// compositor busy every frame for as long as anyone listens.
+	CompositionTarget::Rendering -= m_renderingToken;
+
+	// From the first request to this frame: dispatcher delivery plus the wait for vsync.
+	if (JsWrapper::Tracer::IsEnabled() && m_frameRequestTime != JsWrapper::Tracer::Clock::time_point())
+		JsWrapper::Tracer::Complete("ui", L"frame wait", m_frameRequestTime, JsWrapper::Tracer::Clock::now());
+	m_frameRequestTime = JsWrapper::Tracer::Clock::time_point();
+	m_frameRequested.store(false);
+
+	JsWrapper::TraceSpan span("ui", L"apply");
+	FrameConsole frame(*m_psOutput);
+	m_psCommands->Drain(frame, [this]()
+	{
+		// Lines from before the clear are still pending in the OutputBuffer.
+		m_psOutput->Flush();
+		m_psOutputStore->Clear();
+		ConsoleOutput->Text = L"";
+	});
+	m_psOutput->Flush();
+
+	Background background;
+	if (m_backgroundSlot.TryTake(background))
+	{
+		m_pConsoleBrush->Color = background.color;
+		ConsoleOutput->Background = background.set ? m_pConsoleBrush : nullptr;
+	}
+
+	Rotation rotation;
+	if (m_rotationSlot.TryTake(rotation))
+	{
+		m_pConsoleProjection->RotationX = rotation.x;
+		m_pConsoleProjection->RotationY = rotation.y;
+		m_pConsoleProjection->RotationZ = rotation.z;
+		ConsoleOutput->Projection = rotation.set ? m_pConsoleProjection : nullptr;
+	}
+}
+
 void JsExec::MainPage::Execute()
 {
 	String^ pCodeInput = CodeInput->Text;
 	std::wstring codeInput(pCodeInput->Data());
-	CoreDispatcher^ pUIThreadDispatch = CoreWindow::GetForCurrentThread()->Dispatcher;
 
-	ThreadPool::RunAsync(ref new WorkItemHandler([this, codeInput, pUIThreadDispatch](IAsyncAction^ workItem)
+	// Queued behind any earlier run. The wrapper is taken from the pool when the
+	// runtime thread starts, so this never waits for engine creation.
+	std::shared_ptr<JsWrapper::CommandRing> psCommands = m_psCommands;
+	m_psRuntimeThread->Submit(std::move(codeInput), [psCommands](std::exception_ptr error)
 	{
-		try
-		{
-			m_pWrapper->Execute(codeInput);
-		}
-		catch (JsWrapper::Exception::Script& scriptException)
-		{
-			std::wstring why = scriptException.why();
-			pUIThreadDispatch->RunAsync(CoreDispatcherPriority::High, ref new DispatchedHandler([=]()
-			{
-				ConsoleOutput->Text = ConsoleOutput->Text + L"\n" + L"Exception:\n" + ref new String(why.c_str());
-			}));
-		}
-	}));
+		ReportScriptError(error, *psCommands);
+	});
 }
 
 void JsExec::MainPage::runButton_Click(Platform::Object^ sender, Windows::UI::Xaml::RoutedEventArgs^ e)
@@ -148,13 +321,65 @@ void JsExec::MainPage::CodeInput_KeyDown(Platform::Object^ sender, Windows::UI::
 		Execute();
 	else if (e->Key == Windows::System::VirtualKey::F2)
 		Reset();
+	else if (e->Key == Windows::System::VirtualKey::F3)
+		ToggleTrace();
+}
+
+// First press starts tracing, the second writes trace.json to the app's local
+// folder for chrome://tracing or ui.perfetto.dev.
+void JsExec::MainPage::ToggleTrace()
+{
+	std::wstring message;
+	if (!JsWrapper::Tracer::IsEnabled())
+	{
+		JsWrapper::Tracer::Start();
+		message = L"tracing, F3 again to save";
+	}
+	else
+	{
+		JsWrapper::Tracer::Stop();
+		std::string json = JsWrapper::Tracer::ToJson();
+
+		std::wstring path = std::wstring(Windows::Storage::ApplicationData::Current->LocalFolder->Path->Data()) + L"\\trace.json";
+		FILE* pFile = _wfopen(path.c_str(), L"wb");
+		if (pFile)
+		{
+			std::fwrite(json.data(), 1, json.length(), pFile);
+			std::fclose(pFile);
+			message = L"trace written to " + path;
+		}
+		else
+		{
+			message = L"unable to write " + path;
+		}
+	}
+
+	m_psOutput->Append(message.c_str(), message.length());
+	m_psOutput->Flush();
 }
 
 void JsExec::MainPage::Reset()
 {
-	ConsoleOutput->Text = L"";
-	ConsoleOutput->Background = nullptr;
-	ConsoleOutput->Projection = nullptr;
+	// Stops a runaway script and whatever timers the last one left running, then
+	// continues in a clean context: the spare is swapped in, the old one is
+	// disposed once the runtime thread is idle. A script blocked on a full ring,
+	// e.g. while the window is minimized, gives up the line it was writing.
+	m_psRuntimeThread->Cancel();
+	m_psCommands->CancelWait();
+
+	// The cancelled script's output may still be in the ring, so the console is
+	// cleared by a record behind it rather than right here. Its color and
+	// rotation are replaced by unset ones, published after anything it set.
+	std::shared_ptr<JsWrapper::CommandRing> psCommands = m_psCommands;
+	m_psRuntimeThread->Post([this, psCommands](JsWrapper::IJsWrapper& wrapper)
+	{
+		wrapper.ResetContext();
+		psCommands->Clear();
+		m_backgroundSlot.Publish(Background { Windows::UI::Color(), false });
+		m_rotationSlot.Publish(Rotation { 0, 0, 0, false });
+		RequestFrame();
+	});
+
 	CodeInput->Text = L"";
 }
 
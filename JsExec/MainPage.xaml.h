@@ -6,7 +6,14 @@
 #pragma once
 
 #include "MainPage.g.h"
+#include "CommandRing.h"
 #include "JsWrapper.h"
+#include "OutputBuffer.h"
+#include "OutputStore.h"
+#include "RuntimeThread.h"
+#include "StateSlot.h"
+#include "Tracer.h"
+#include "WrapperPool.h"
 
 namespace JsExec
 {
@@ -17,10 +24,35 @@ namespace JsExec
 	{
 	public:
 		MainPage();
+		virtual ~MainPage();
+
+	internal:
+		// Called from the runtime thread. Only the newest value is applied, on the next frame.
+		void PublishColor(Windows::UI::Color color);
+		void PublishRotation(double x, double y, double z);
 
 	private:
+		// set is false once Reset has cleared the state.
+		struct Background
+		{
+			Windows::UI::Color color;
+			bool set;
+		};
+
+		struct Rotation
+		{
+			double x;
+			double y;
+			double z;
+			bool set;
+		};
+
+		void RequestFrame();
+		void OnRendering(Platform::Object^ sender, Platform::Object^ e);
+
 		void Execute();
 		void Reset();
+		void ToggleTrace();
 
 		void CodeInput_TextChanged(Platform::Object^ sender, Windows::UI::Xaml::Controls::TextChangedEventArgs^ e);
 		void runButton_Click(Platform::Object^ sender, Windows::UI::Xaml::RoutedEventArgs^ e);
@@ -28,6 +60,20 @@ namespace JsExec
 		void resetButton_Click(Platform::Object^ sender, Windows::UI::Xaml::RoutedEventArgs^ e);
 
 	private:
-		std::unique_ptr<JsWrapper::IJsWrapper> m_pWrapper;
+		Windows::UI::Core::CoreDispatcher^ m_pDispatcher;
+		std::atomic<bool> m_frameRequested;
+		JsWrapper::Tracer::Clock::time_point m_frameRequestTime; // written by whoever set m_frameRequested
+		Windows::Foundation::EventRegistrationToken m_renderingToken;
+
+		JsWrapper::StateSlot<Background> m_backgroundSlot;
+		JsWrapper::StateSlot<Rotation> m_rotationSlot;
+		Windows::UI::Xaml::Media::SolidColorBrush^ m_pConsoleBrush;
+		Windows::UI::Xaml::Media::PlaneProjection^ m_pConsoleProjection;
+
+		std::shared_ptr<JsWrapper::OutputStore> m_psOutputStore;
+		std::shared_ptr<JsWrapper::OutputBuffer> m_psOutput;
+		std::shared_ptr<JsWrapper::CommandRing> m_psCommands; // console text, runtime thread to UI thread
+		std::unique_ptr<JsWrapper::WrapperPool> m_psWrapperPool;
+		std::unique_ptr<JsWrapper::RuntimeThread> m_psRuntimeThread;
 	};
 }
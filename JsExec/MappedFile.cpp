@@ -0,0 +1,80 @@
+#include "pch.h"
+#include "MappedFile.h"
+#include "JsrtCompat.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace JsWrapper
+{
+
+#ifdef _WIN32
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::wstring& path)
+{
+	HANDLE hFile = CreateFile2(path.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER fileSize;
+	HANDLE hMapping = nullptr;
+	if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0)
+		hMapping = CreateFileMappingFromApp(hFile, nullptr, PAGE_WRITECOPY, 0, nullptr);
+
+	// The section keeps the file open.
+	CloseHandle(hFile);
+	if (!hMapping)
+		return nullptr;
+
+	void* pView = MapViewOfFileFromApp(hMapping, FILE_MAP_COPY, 0, 0);
+	if (!pView)
+	{
+		CloseHandle(hMapping);
+		return nullptr;
+	}
+
+	return std::unique_ptr<MappedFile>(new MappedFile(static_cast<unsigned char*>(pView), static_cast<size_t>(fileSize.QuadPart), hMapping));
+}
+
+MappedFile::~MappedFile()
+{
+	UnmapViewOfFile(m_pData);
+	CloseHandle(m_pMapping);
+}
+
+#else
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::wstring& path)
+{
+	std::string utf8Path = Jsrt::ToUtf8(path.c_str(), path.length());
+	int fd = open(utf8Path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	void* pView = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		pView = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	// The mapping keeps the file open.
+	close(fd);
+	if (pView == MAP_FAILED)
+		return nullptr;
+
+	return std::unique_ptr<MappedFile>(new MappedFile(static_cast<unsigned char*>(pView), static_cast<size_t>(info.st_size), nullptr));
+}
+
+MappedFile::~MappedFile()
+{
+	munmap(m_pData, m_size);
+}
+
+#endif
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace JsWrapper
+{
+
+// Read-only view of a whole file. Pages are mapped copy-on-write, so a consumer
+// that writes into the view (the engine is handed a non-const pointer) never
+// touches the file on disk.
+class MappedFile
+{
+public:
+	// Returns nullptr if the file doesn't exist, is empty or can't be mapped.
+	static std::unique_ptr<MappedFile> Open(const std::wstring& path);
+
+	~MappedFile();
+
+	unsigned char* Data() const { return m_pData; }
+	size_t Size() const { return m_size; }
+
+private:
+	MappedFile(unsigned char* pData, size_t size, void* pMapping) : m_pData(pData), m_size(size), m_pMapping(pMapping) { }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	unsigned char* m_pData;
+	size_t m_size;
+	void* m_pMapping; // Windows: the section handle. Unused elsewhere.
+};
+
+}
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "CallStats.h"
+#include "JsWrapper.h"
+#include "JsrtCompat.h"
+#include "Tracer.h"
+
+namespace JsWrapper
+{
+namespace Binding
+{
+	// Turns a plain C++ function into a JsNativeFunction at compile time:
+	//
+	//     static void SetRotation(IExecutionContext& executionContext, double x, double y, double z);
+	//     Define<decltype(&SetRotation), &SetRotation>(L"set_rotation", L"set the console rotation")
+	//
+	// The thunk checks the argument count, converts each argument according to its
+	// parameter type and converts the return value back. Nothing is allocated on
+	// the way in. Any exception is caught at the boundary and reported to the console
+	// as "<name>failed", since it can't be thrown back through the engine. Every
+	// call's latency, and whether it failed, goes to the function's CallCounters,
+	// and to the Tracer ("host" category) while tracing.
+	//
+	// Parameter types: double, int, bool, StringView, Function, Float64Array,
+	// Optional<T> and Rest (last only). Return types: void, int, double, Promise, Object.
+
+	// A script function argument. Anything else is rejected.
+	struct Function
+	{
+		JsValueRef value;
+	};
+
+	// A Float64Array argument, read in place: pValues is the array's own
+	// storage, valid while the array is and only on the runtime's thread.
+	struct Float64Array
+	{
+		JsValueRef value;
+		const double* pValues;
+		size_t count;
+	};
+
+	// A promise handed back to script.
+	struct Promise
+	{
+		JsValueRef value;
+	};
+
+	// Any other value handed back to script, e.g. a plain object.
+	struct Object
+	{
+		JsValueRef value;
+	};
+
+	// All remaining arguments, possibly none.
+	struct Rest
+	{
+		const JsValueRef* pValues;
+		unsigned short count;
+	};
+
+	// An argument script may leave out.
+	template <class T>
+	struct Optional
+	{
+		bool present;
+		T value;
+	};
+
+	struct FunctionDefinition
+	{
+		const wchar_t* wzName;
+		JsNativeFunction function;
+		const wchar_t* wzHelpText;
+		std::wstring signature; // e.g. "(number, number, number)", derived from the C++ parameter types
+	};
+
+	// The callbackState of every bound function, one per function and wrapper.
+	struct CallState
+	{
+		IExecutionContext* pExecutionContext;
+		const FunctionDefinition* pDefinition;
+		CallCounters* pCounters;
+	};
+
+	inline void ThrowIfError(JsErrorCode error)
+	{
+		if (error != JsNoError)
+			throw std::runtime_error("API Failure");
+	}
+
+	// Per parameter type: how many arguments it requires, whether it takes all
+	// remaining ones, its name in help text and how to convert it.
+	template <class T>
+	struct Argument;
+
+	template <>
+	struct Argument<double>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"number"; }
+		static double Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueRef number;
+			ThrowIfError(JsConvertValueToNumber(arguments[index], &number));
+			double value;
+			ThrowIfError(JsNumberToDouble(number, &value));
+			return value;
+		}
+	};
+
+	template <>
+	struct Argument<int>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"integer"; }
+		static int Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueRef number;
+			ThrowIfError(JsConvertValueToNumber(arguments[index], &number));
+			int value;
+			ThrowIfError(JsNumberToInt(number, &value));
+			return value;
+		}
+	};
+
+	template <>
+	struct Argument<bool>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"boolean"; }
+		static bool Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueRef boolean;
+			ThrowIfError(JsConvertValueToBoolean(arguments[index], &boolean));
+			bool value;
+			ThrowIfError(JsBooleanToBool(boolean, &value));
+			return value;
+		}
+	};
+
+	// Borrowed from the engine, see Jsrt::StringToPointer. On ChakraCore all strings
+	// share one scratch buffer per thread, so a function takes at most one.
+	template <>
+	struct Argument<StringView>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"string"; }
+		static StringView Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueRef string;
+			ThrowIfError(JsConvertValueToString(arguments[index], &string));
+			const wchar_t* wzString;
+			size_t length;
+			ThrowIfError(Jsrt::StringToPointer(string, &wzString, &length));
+			return StringView(wzString, length);
+		}
+	};
+
+	template <>
+	struct Argument<Function>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"function"; }
+		static Function Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueType type;
+			ThrowIfError(JsGetValueType(arguments[index], &type));
+			if (type != JsFunction)
+				throw std::invalid_argument("function expected");
+			return Function { arguments[index] };
+		}
+	};
+
+	template <>
+	struct Argument<Float64Array>
+	{
+		static const unsigned short required = 1;
+		static const bool rest = false;
+		static std::wstring Name() { return L"Float64Array"; }
+		static Float64Array Convert(const JsValueRef* arguments, unsigned short, unsigned short index)
+		{
+			JsValueType type;
+			ThrowIfError(JsGetValueType(arguments[index], &type));
+			if (type != JsTypedArray)
+				throw std::invalid_argument("Float64Array expected");
+
+			unsigned char* pStorage;
+			unsigned int bytes;
+			JsTypedArrayType arrayType;
+			int elementSize;
+			ThrowIfError(JsGetTypedArrayStorage(arguments[index], &pStorage, &bytes, &arrayType, &elementSize));
+			if (arrayType != JsArrayTypeFloat64)
+				throw std::invalid_argument("Float64Array expected");
+
+			return Float64Array { arguments[index], reinterpret_cast<const double*>(pStorage), bytes / sizeof(double) };
+		}
+	};
+
+	template <>
+	struct Argument<Rest>
+	{
+		static const unsigned short required = 0;
+		static const bool rest = true;
+		static std::wstring Name() { return L"..."; }
+		static Rest Convert(const JsValueRef* arguments, unsigned short count, unsigned short index)
+		{
+			return index < count ? Rest { arguments + index, static_cast<unsigned short>(count - index) } : Rest { nullptr, 0 };
+		}
+	};
+
+	template <class T>
+	struct Argument<Optional<T>>
+	{
+		static const unsigned short required = 0;
+		static const bool rest = false;
+		static std::wstring Name() { return Argument<T>::Name() + L"?"; }
+		static Optional<T> Convert(const JsValueRef* arguments, unsigned short count, unsigned short index)
+		{
+			if (index >= count)
+				return Optional<T> { false, T() };
+			return Optional<T> { true, Argument<T>::Convert(arguments, count, index) };
+		}
+	};
+
+	template <class R>
+	struct Result;
+
+	template <>
+	struct Result<int>
+	{
+		static std::wstring Name() { return L"integer"; }
+		static JsValueRef ToValue(int value)
+		{
+			JsValueRef number;
+			ThrowIfError(JsIntToNumber(value, &number));
+			return number;
+		}
+	};
+
+	template <>
+	struct Result<double>
+	{
+		static std::wstring Name() { return L"number"; }
+		static JsValueRef ToValue(double value)
+		{
+			JsValueRef number;
+			ThrowIfError(JsDoubleToNumber(value, &number));
+			return number;
+		}
+	};
+
+	template <>
+	struct Result<Promise>
+	{
+		static std::wstring Name() { return L"promise"; }
+		static JsValueRef ToValue(Promise value) { return value.value; }
+	};
+
+	template <>
+	struct Result<Object>
+	{
+		static std::wstring Name() { return L"object"; }
+		static JsValueRef ToValue(Object value) { return value.value; }
+	};
+
+	// Totals over a parameter list.
+	template <class... Args>
+	struct Parameters;
+
+	template <>
+	struct Parameters<>
+	{
+		static const unsigned short required = 0;
+		static const bool rest = false;
+		static const unsigned strings = 0;
+	};
+
+	template <class T, class... Args>
+	struct Parameters<T, Args...>
+	{
+		static_assert(!Argument<T>::rest || sizeof...(Args) == 0, "Rest must be the last parameter");
+
+		static const unsigned short required = Argument<T>::required + Parameters<Args...>::required;
+		static const bool rest = Argument<T>::rest || Parameters<Args...>::rest;
+		static const unsigned strings = (std::is_same<T, StringView>::value ? 1 : 0) + Parameters<Args...>::strings;
+	};
+
+	template <class R>
+	struct Invoker
+	{
+		template <class F, class Tuple, size_t... Is>
+		static JsValueRef Call(F fn, IExecutionContext& executionContext, Tuple& values, std::index_sequence<Is...>)
+		{
+			return Result<R>::ToValue(fn(executionContext, std::get<Is>(values)...));
+		}
+
+		static std::wstring Name() { return L" -> " + Result<R>::Name(); }
+	};
+
+	template <>
+	struct Invoker<void>
+	{
+		template <class F, class Tuple, size_t... Is>
+		static JsValueRef Call(F fn, IExecutionContext& executionContext, Tuple& values, std::index_sequence<Is...>)
+		{
+			fn(executionContext, std::get<Is>(values)...);
+			return JS_INVALID_REFERENCE;
+		}
+
+		static std::wstring Name() { return std::wstring(); }
+	};
+
+	template <class F, F fn>
+	struct Thunk;
+
+	template <class R, class... Args, R (*fn)(IExecutionContext&, Args...)>
+	struct Thunk<R (*)(IExecutionContext&, Args...), fn>
+	{
+		static_assert(Parameters<Args...>::strings <= 1, "At most one StringView parameter");
+
+		static JsValueRef CALLBACK Call(JsValueRef, bool, JsValueRef* arguments, unsigned short argumentCount, void* callbackState)
+		{
+			const CallState& state = *static_cast<const CallState*>(callbackState);
+
+			// arguments[0] is 'this'.
+			unsigned short count = argumentCount > 0 ? static_cast<unsigned short>(argumentCount - 1) : 0;
+			auto start = std::chrono::steady_clock::now();
+			JsValueRef result = JS_INVALID_REFERENCE;
+			bool failed = false;
+			std::string reason;
+
+			try
+			{
+				if (count < Parameters<Args...>::required || (!Parameters<Args...>::rest && count > sizeof...(Args)))
+					throw std::invalid_argument("wrong number of arguments");
+
+				result = Unpack(*state.pExecutionContext, arguments + 1, count, std::index_sequence_for<Args...>());
+			}
+			catch (const std::exception& e)
+			{
+				failed = true;
+				reason = e.what();
+			}
+			catch (...)
+			{
+				failed = true;
+			}
+
+			auto end = std::chrono::steady_clock::now();
+			state.pCounters->Record(end - start, failed);
+			if (Tracer::IsEnabled())
+				Tracer::Complete("host", state.pDefinition->wzName, start, end);
+
+			// Nothing may escape into the engine, not even a console that can't take the line.
+			if (failed)
+			{
+				try
+				{
+					std::wstring message = std::wstring(state.pDefinition->wzName) + L"failed";
+					if (!reason.empty())
+						message += L": " + Jsrt::FromUtf8(reason.data(), reason.size());
+					state.pExecutionContext->Console().Append(message);
+				}
+				catch (...)
+				{
+				}
+			}
+			return result;
+		}
+
+		static std::wstring Signature()
+		{
+			const std::wstring names[] = { Argument<Args>::Name()..., std::wstring() };
+
+			std::wstring signature = L"(";
+			for (size_t i = 0; i < sizeof...(Args); i++)
+				signature += (i > 0 ? L", " : L"") + names[i];
+			return signature + L")" + Invoker<R>::Name();
+		}
+
+	private:
+		template <size_t... Is>
+		static JsValueRef Unpack(IExecutionContext& executionContext, const JsValueRef* arguments, unsigned short count, std::index_sequence<Is...> indices)
+		{
+			(void)arguments, (void)count; // unused without parameters
+
+			// Braced initialization converts left to right, in the order script passed them.
+			std::tuple<Args...> values { Argument<Args>::Convert(arguments, count, static_cast<unsigned short>(Is))... };
+			return Invoker<R>::Call(fn, executionContext, values, indices);
+		}
+	};
+
+	template <class F, F fn>
+	FunctionDefinition Define(const wchar_t* wzName, const wchar_t* wzHelpText)
+	{
+		return FunctionDefinition { wzName, &Thunk<F, fn>::Call, wzHelpText, Thunk<F, fn>::Signature() };
+	}
+}
+}
@@ -0,0 +1,79 @@
+#include "pch.h"
+#include "OutputBuffer.h"
+#include "Tracer.h"
+
+namespace JsWrapper
+{
+
+OutputBuffer::OutputBuffer(std::unique_ptr<IOutputSink>&& psSink, size_t thresholdChars, FlushRequest requestFlush)
+	: m_psSink(std::move(psSink)), m_thresholdChars(thresholdChars), m_requestFlush(std::move(requestFlush))
+{
+	m_pending.reserve(m_thresholdChars);
+}
+
+OutputBuffer::~OutputBuffer()
+{
+	Flush();
+}
+
+void OutputBuffer::Append(const wchar_t* wzText, size_t length)
+{
+	bool requestFlush = false;
+	bool flushNow = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_pendingLines > 0)
+			m_pending.push_back(L'\n');
+		m_pending.append(wzText, length);
+		m_pendingLines++;
+
+		if (m_requestFlush)
+		{
+			requestFlush = !m_flushRequested;
+			m_flushRequested = true;
+		}
+		else
+		{
+			flushNow = m_pending.length() >= m_thresholdChars;
+		}
+	}
+
+	if (requestFlush)
+		m_requestFlush();
+	else if (flushNow)
+		Flush();
+}
+
+void OutputBuffer::Flush()
+{
+	std::lock_guard<std::mutex> flushLock(m_flushLock);
+	TraceSpan span("output", L"flush");
+
+	size_t lineCount;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_batch.clear();
+		m_batch.swap(m_pending);
+		lineCount = m_pendingLines;
+		m_pendingLines = 0;
+		m_flushRequested = false;
+
+		if (lineCount > 0)
+		{
+			m_stats.lines += lineCount;
+			m_stats.batches++;
+			m_stats.chars += m_batch.length();
+		}
+	}
+
+	if (lineCount > 0)
+		m_psSink->Write(m_batch, lineCount);
+}
+
+OutputBuffer::Stats OutputBuffer::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace JsWrapper
+{
+
+// Destination for batched console output. Receives lines joined with '\n'.
+class IOutputSink
+{
+public:
+	virtual ~IOutputSink() {};
+	virtual void Write(const std::wstring& lines, size_t lineCount) = 0;
+};
+
+// Collects console lines from the runtime thread and hands them to a sink in
+// batches, so a script logging in a loop costs one sink write per batch
+// instead of one per line.
+//
+// With a flush request callback (the UI case) the buffer asks the host to call
+// Flush once when the first line of a batch arrives, typically on its next frame,
+// and everything appended until then goes out together. Without one, Append
+// flushes by itself once thresholdChars are pending; the sink is then called on
+// the appending thread.
+class OutputBuffer
+{
+public:
+	using FlushRequest = std::function<void()>;
+
+	struct Stats
+	{
+		unsigned long long lines { 0 };
+		unsigned long long batches { 0 };
+		unsigned long long chars { 0 };
+	};
+
+	OutputBuffer(std::unique_ptr<IOutputSink>&& psSink, size_t thresholdChars, FlushRequest requestFlush = nullptr);
+	~OutputBuffer();
+
+	// Thread safe.
+	void Append(const wchar_t* wzText, size_t length);
+
+	// Writes everything pending to the sink. Calls are serialized, batches keep their order.
+	void Flush();
+
+	Stats GetStats() const;
+
+private:
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+	const std::unique_ptr<IOutputSink> m_psSink;
+	const size_t m_thresholdChars;
+	const FlushRequest m_requestFlush;
+
+	mutable std::mutex m_lock;
+	std::wstring m_pending;
+	size_t m_pendingLines { 0 };
+	bool m_flushRequested { false };
+	Stats m_stats;
+
+	// Held while writing to the sink. m_batch keeps its capacity between flushes.
+	std::mutex m_flushLock;
+	std::wstring m_batch;
+};
+
+}
@@ -0,0 +1,138 @@
+#include "pch.h"
+#include "OutputStore.h"
+
+#include <algorithm>
+#include <cwchar>
+
+namespace JsWrapper
+{
+
+OutputStore::OutputStore(size_t capacityBytes, size_t chunkChars) : m_capacityBytes(capacityBytes), m_chunkChars(std::max<size_t>(chunkChars, 1))
+{
+}
+
+OutputStore::~OutputStore() = default;
+
+void OutputStore::AppendLine(const wchar_t* wzLine, size_t length)
+{
+	m_lineStarts.push_back(m_endOffset);
+	AppendText(wzLine, length);
+	Trim();
+}
+
+void OutputStore::AppendLines(const wchar_t* wzLines, size_t length)
+{
+	const wchar_t* wzEnd = wzLines + length;
+	for (;;)
+	{
+		const wchar_t* wzNewline = std::wmemchr(wzLines, L'\n', wzEnd - wzLines);
+		if (!wzNewline)
+			break;
+		AppendLine(wzLines, wzNewline - wzLines);
+		wzLines = wzNewline + 1;
+	}
+	AppendLine(wzLines, wzEnd - wzLines);
+}
+
+void OutputStore::Clear()
+{
+	if (!m_chunks.empty() && !m_psSpareChunk)
+		m_psSpareChunk = std::move(m_chunks.back());
+	m_chunks.clear();
+
+	m_firstLine = EndLine();
+	m_lineStarts.clear();
+	m_chunksOffset = m_endOffset;
+}
+
+uint64_t OutputStore::LineAt(uint64_t offset) const
+{
+	auto it = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), offset);
+	if (it == m_lineStarts.begin())
+		return m_firstLine;
+	return m_firstLine + (it - m_lineStarts.begin()) - 1;
+}
+
+void OutputStore::CopyLines(uint64_t first, uint64_t end, std::wstring& text) const
+{
+	text.clear();
+	first = std::max(first, m_firstLine);
+	end = std::min(end, EndLine());
+
+	for (uint64_t line = first; line < end; line++)
+	{
+		size_t index = static_cast<size_t>(line - m_firstLine);
+		uint64_t lineEnd = (index + 1 < m_lineStarts.size()) ? m_lineStarts[index + 1] : m_endOffset;
+
+		if (line != first)
+			text.push_back(L'\n');
+		CopyText(m_lineStarts[index], lineEnd, text);
+	}
+}
+
+size_t OutputStore::Bytes() const
+{
+	return m_chunks.size() * m_chunkChars * sizeof(wchar_t) + m_lineStarts.size() * sizeof(uint64_t);
+}
+
+void OutputStore::AppendText(const wchar_t* wzText, size_t length)
+{
+	while (length > 0)
+	{
+		size_t used = static_cast<size_t>(m_endOffset - m_chunksOffset);
+		if (used == m_chunks.size() * m_chunkChars)
+		{
+			if (m_psSpareChunk)
+				m_chunks.push_back(std::move(m_psSpareChunk));
+			else
+				m_chunks.emplace_back(new wchar_t[m_chunkChars]);
+		}
+
+		size_t position = used % m_chunkChars;
+		size_t count = std::min(length, m_chunkChars - position);
+		std::wmemcpy(m_chunks.back().get() + position, wzText, count);
+
+		m_endOffset += count;
+		wzText += count;
+		length -= count;
+	}
+}
+
+void OutputStore::CopyText(uint64_t begin, uint64_t end, std::wstring& text) const
+{
+	while (begin < end)
+	{
+		size_t relative = static_cast<size_t>(begin - m_chunksOffset);
+		size_t position = relative % m_chunkChars;
+		size_t count = static_cast<size_t>(std::min<uint64_t>(end - begin, m_chunkChars - position));
+		text.append(m_chunks[relative / m_chunkChars].get() + position, count);
+		begin += count;
+	}
+}
+
+void OutputStore::Trim()
+{
+	// Always keep the chunk being written to.
+	while (Bytes() > m_capacityBytes && m_chunks.size() > 1)
+	{
+		m_psSpareChunk = std::move(m_chunks.front());
+		m_chunks.pop_front();
+		m_chunksOffset += m_chunkChars;
+
+		// A line that started in the recycled chunk has lost its beginning, drop it whole.
+		while (!m_lineStarts.empty() && m_lineStarts.front() < m_chunksOffset)
+		{
+			m_lineStarts.pop_front();
+			m_firstLine++;
+		}
+	}
+
+	// Lots of short lines can outgrow the cap through the index alone.
+	while (Bytes() > m_capacityBytes && m_lineStarts.size() > 1)
+	{
+		m_lineStarts.pop_front();
+		m_firstLine++;
+	}
+}
+
+}
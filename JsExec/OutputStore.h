@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace JsWrapper
+{
+
+// Console history kept in fixed-size chunks with an index of line starts.
+//
+// Text is addressed by a logical character offset that only grows. Appending
+// writes into the last chunk and pushes one index entry per line, so it never
+// copies earlier text. Once the chunks plus the index exceed capacityBytes the
+// oldest chunk is recycled and the lines starting in it are dropped, which keeps
+// memory flat however long a script keeps logging. Line numbers keep counting
+// across drops; FirstLine() is the oldest one still stored.
+//
+// Not thread safe. The app only touches it from the UI thread.
+class OutputStore
+{
+public:
+	explicit OutputStore(size_t capacityBytes, size_t chunkChars = 16 * 1024);
+	~OutputStore();
+
+	void AppendLine(const wchar_t* wzLine, size_t length);
+
+	// Lines separated by '\n', as delivered by OutputBuffer.
+	void AppendLines(const wchar_t* wzLines, size_t length);
+
+	void Clear();
+
+	uint64_t FirstLine() const { return m_firstLine; }
+	uint64_t EndLine() const { return m_firstLine + m_lineStarts.size(); }
+
+	// Line containing the given logical character offset, O(log n). Offsets
+	// before the oldest stored line map to FirstLine().
+	uint64_t LineAt(uint64_t offset) const;
+
+	// Replaces text with lines [first, end) joined by '\n'. Lines that are no longer stored are skipped.
+	void CopyLines(uint64_t first, uint64_t end, std::wstring& text) const;
+
+	size_t Bytes() const;
+
+private:
+	OutputStore(const OutputStore&) = delete;
+	OutputStore& operator=(const OutputStore&) = delete;
+
+	void AppendText(const wchar_t* wzText, size_t length);
+	void CopyText(uint64_t begin, uint64_t end, std::wstring& text) const;
+	void Trim();
+
+	const size_t m_capacityBytes;
+	const size_t m_chunkChars;
+
+	std::deque<std::unique_ptr<wchar_t[]>> m_chunks;
+	std::unique_ptr<wchar_t[]> m_psSpareChunk;
+	uint64_t m_chunksOffset { 0 }; // logical offset of m_chunks.front()[0]
+	uint64_t m_endOffset { 0 };
+
+	std::deque<uint64_t> m_lineStarts;
+	uint64_t m_firstLine { 0 };
+};
+
+}
@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "RuntimeThread.h"
+#include "Tracer.h"
+
+namespace JsWrapper
+{
+
+RuntimeThread::RuntimeThread(WrapperFactory wrapperFactory, CompletionHandler onTimerError) : m_onTimerError(std::move(onTimerError))
+{
+	Node* pStub = new Node();
+	m_pHead.store(pStub, std::memory_order_relaxed);
+	m_pTail = pStub;
+
+	m_thread = std::thread([this, wrapperFactory]() { ThreadLoop(wrapperFactory); });
+}
+
+RuntimeThread::~RuntimeThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeLock);
+		m_stopping = true;
+	}
+	m_wake.notify_one();
+
+	// A script that never returns would keep join waiting forever. A Cancel
+	// that lands before a job has entered the wrapper only drops what earlier
+	// ones left behind, so it's repeated until the thread is done.
+	std::future<void> exited = m_exited.get_future();
+	do
+	{
+		Cancel();
+	} while (exited.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready);
+	m_thread.join();
+
+	delete m_pTail;
+}
+
+std::future<void> RuntimeThread::Post(Job job)
+{
+	Node* pNode = new Node();
+	pNode->job = std::move(job);
+	std::future<void> result = pNode->promise.get_future();
+
+	Push(pNode);
+	m_submitted.fetch_add(1, std::memory_order_relaxed);
+
+	size_t depth = m_depth.fetch_add(1) + 1;
+	size_t maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+	while (depth > maxDepth && !m_maxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) { }
+
+	// Only the empty -> non-empty transition can find the thread asleep.
+	if (depth == 1)
+	{
+		std::lock_guard<std::mutex> lock(m_wakeLock);
+		m_wake.notify_one();
+	}
+
+	return result;
+}
+
+std::future<void> RuntimeThread::Submit(std::wstring code, CompletionHandler onComplete)
+{
+	return Post([code = std::move(code), onComplete](IJsWrapper& wrapper)
+	{
+		try
+		{
+			wrapper.Execute(code);
+		}
+		catch (...)
+		{
+			if (onComplete)
+				onComplete(std::current_exception());
+			throw;
+		}
+
+		if (onComplete)
+			onComplete(nullptr);
+	});
+}
+
+void RuntimeThread::Cancel()
+{
+	std::lock_guard<std::mutex> lock(m_wrapperLock);
+	if (m_pWrapper)
+		m_pWrapper->Cancel();
+}
+
+RuntimeThread::Stats RuntimeThread::GetStats() const
+{
+	return Stats { m_submitted.load(), m_completed.load(), m_depth.load(), m_maxDepth.load() };
+}
+
+void RuntimeThread::Push(Node* pNode)
+{
+	Node* pPrevious = m_pHead.exchange(pNode, std::memory_order_acq_rel);
+	pPrevious->next.store(pNode, std::memory_order_release);
+}
+
+RuntimeThread::Node* RuntimeThread::Pop()
+{
+	Node* pNext = m_pTail->next.load(std::memory_order_acquire);
+	if (!pNext)
+		return nullptr;
+
+	delete m_pTail;
+	m_pTail = pNext;
+	return pNext;
+}
+
+void RuntimeThread::ThreadLoop(WrapperFactory wrapperFactory)
+{
+	Tracer::SetThreadName("runtime");
+
+	std::unique_ptr<IJsWrapper> pWrapper;
+	std::exception_ptr creationError;
+	try
+	{
+		pWrapper = wrapperFactory();
+	}
+	catch (...)
+	{
+		creationError = std::current_exception();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_wrapperLock);
+		m_pWrapper = pWrapper.get();
+	}
+
+	for (;;)
+	{
+		std::chrono::steady_clock::time_point nextDue;
+		bool timerPending = RunTimers(pWrapper.get(), nextDue);
+
+		if (m_depth.load() == 0)
+		{
+			// Nothing queued: a good time for the wrapper's spare context and cleanup.
+			RunIdleTasks(pWrapper.get());
+
+			auto wakeCondition = [this]() { return m_stopping || m_depth.load() > 0; };
+
+			std::unique_lock<std::mutex> lock(m_wakeLock);
+			if (timerPending)
+				m_wake.wait_until(lock, nextDue, wakeCondition);
+			else
+				m_wake.wait(lock, wakeCondition);
+
+			if (m_depth.load() == 0)
+			{
+				if (m_stopping)
+					break;
+				continue; // a timer is due
+			}
+		}
+
+		// depth counts a job before a producer finishes linking it in.
+		Node* pNode;
+		while (!(pNode = Pop()))
+			std::this_thread::yield();
+
+		// pNode is the new tail, release what it holds before the next Pop frees it.
+		Job job = std::move(pNode->job);
+		std::promise<void> promise = std::move(pNode->promise);
+		try
+		{
+			if (!pWrapper)
+				std::rethrow_exception(creationError);
+			if (m_stopping.load())
+				throw Exception::Cancelled();
+
+			job(*pWrapper);
+			promise.set_value();
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+		}
+
+		m_completed.fetch_add(1, std::memory_order_relaxed);
+		m_depth.fetch_sub(1);
+	}
+
+	// No Cancel is in the wrapper once it's cleared, it can go.
+	{
+		std::lock_guard<std::mutex> lock(m_wrapperLock);
+		m_pWrapper = nullptr;
+	}
+	pWrapper.reset();
+	m_exited.set_value();
+}
+
+void RuntimeThread::RunIdleTasks(IJsWrapper* pWrapper)
+{
+	if (!pWrapper)
+		return;
+
+	try
+	{
+		pWrapper->RunIdleTasks();
+	}
+	catch (...)
+	{
+		// Tried again next time, ResetContext copes without a spare.
+	}
+}
+
+bool RuntimeThread::RunTimers(IJsWrapper* pWrapper, std::chrono::steady_clock::time_point& nextDue)
+{
+	if (!pWrapper)
+		return false;
+
+	try
+	{
+		return pWrapper->RunTimers(nextDue);
+	}
+	catch (...)
+	{
+		if (m_onTimerError)
+			m_onTimerError(std::current_exception());
+	}
+
+	// Other timers may still be due, come back right away.
+	nextDue = std::chrono::steady_clock::now();
+	return true;
+}
+
+}
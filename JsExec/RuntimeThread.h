@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// A long-lived thread that owns one wrapper and runs submitted work on it in
+// submission order. Submitting never blocks: jobs go through a lock-free
+// multi-producer/single-consumer queue and the thread is only woken when the
+// queue goes from empty to non-empty, or when the wrapper has a timer due.
+// Before it sleeps it gives the wrapper its idle tasks (IJsWrapper::RunIdleTasks).
+class RuntimeThread
+{
+public:
+	// Runs on the runtime thread, e.g. WrapperPool::Acquire or CreateInstance.
+	using WrapperFactory = std::function<std::unique_ptr<IJsWrapper>()>;
+	using Job = std::function<void(IJsWrapper&)>;
+	// Runs on the runtime thread after a script, with its exception (if any).
+	// Also used for exceptions thrown by timer callbacks.
+	using CompletionHandler = std::function<void(std::exception_ptr)>;
+
+	struct Stats
+	{
+		unsigned long long submitted;
+		unsigned long long completed;
+		size_t depth;    // queued or running
+		size_t maxDepth;
+	};
+
+	explicit RuntimeThread(WrapperFactory wrapperFactory, CompletionHandler onTimerError = nullptr);
+
+	// Cancels the script running now and drops the jobs still queued, whose
+	// futures get Exception::Cancelled, then destroys the wrapper on its thread.
+	// Pending timers are dropped.
+	~RuntimeThread();
+
+	std::future<void> Post(Job job);
+	std::future<void> Submit(std::wstring code, CompletionHandler onComplete = nullptr);
+
+	// Any thread. Cancels the script or timer callback running now and drops the
+	// wrapper's pending timers, see IJsWrapper::Cancel. Jobs still queued run as usual.
+	void Cancel();
+
+	Stats GetStats() const;
+
+private:
+	struct Node
+	{
+		std::atomic<Node*> next { nullptr };
+		Job job;
+		std::promise<void> promise;
+	};
+
+	RuntimeThread(const RuntimeThread&) = delete;
+	RuntimeThread& operator=(const RuntimeThread&) = delete;
+
+	void Push(Node* pNode);
+	Node* Pop();
+	void ThreadLoop(WrapperFactory wrapperFactory);
+	void RunIdleTasks(IJsWrapper* pWrapper);
+	bool RunTimers(IJsWrapper* pWrapper, std::chrono::steady_clock::time_point& nextDue);
+
+	// Vyukov MPSC queue: producers swap m_pHead, the runtime thread owns m_pTail,
+	// which is always a consumed (or stub) node.
+	std::atomic<Node*> m_pHead;
+	Node* m_pTail;
+
+	std::atomic<size_t> m_depth { 0 };
+	std::atomic<size_t> m_maxDepth { 0 };
+	std::atomic<unsigned long long> m_submitted { 0 };
+	std::atomic<unsigned long long> m_completed { 0 };
+
+	// Set while the thread owns one. Cancel holds m_wrapperLock while it calls
+	// into the wrapper, so the thread can't destroy it meanwhile.
+	std::mutex m_wrapperLock;
+	IJsWrapper* m_pWrapper { nullptr };
+
+	std::mutex m_wakeLock;
+	std::condition_variable m_wake;
+	std::atomic<bool> m_stopping { false }; // set under m_wakeLock
+
+	const CompletionHandler m_onTimerError;
+	std::promise<void> m_exited; // set once ThreadLoop has destroyed the wrapper
+	std::thread m_thread;
+};
+
+}
@@ -0,0 +1,138 @@
+#include "pch.h"
+#include "SamplingProfiler.h"
+
+#include <stdexcept>
+
+#ifdef JSEXEC_CHAKRACORE
+namespace
+{
+	void ThrowIfError(JsErrorCode error, const char* szApi)
+	{
+		if (error != JsNoError)
+			throw std::runtime_error(std::string("API Failure: ") + szApi);
+	}
+
+	void CHAKRA_CALLBACK OnDebugEvent(JsDiagDebugEvent debugEvent, JsValueRef eventData, void* callbackState)
+	{
+		// Breakpoints and debugger statements just resume.
+		if (debugEvent == JsDiagDebugEventAsyncBreak)
+			static_cast<JsWrapper::SamplingProfiler*>(callbackState)->Sample();
+	}
+}
+#endif
+
+namespace JsWrapper
+{
+
+void SamplingProfile::AddSample(const std::string& foldedStack)
+{
+	m_stacks[foldedStack]++;
+	m_samples++;
+}
+
+std::string SamplingProfile::Folded() const
+{
+	std::string folded;
+	for (auto& stack : m_stacks)
+		folded += stack.first + " " + std::to_string(stack.second) + "\n";
+	return folded;
+}
+
+SamplingProfiler::SamplingProfiler(JsRuntimeHandle runtime, SamplingProfile& profile) : m_runtime(runtime), m_profile(profile)
+{
+#ifdef JSEXEC_CHAKRACORE
+	ThrowIfError(Jsrt::GetPropertyIdFromName(L"length", &m_lengthId), "GetPropertyIdFromName");
+	ThrowIfError(Jsrt::GetPropertyIdFromName(L"functionHandle", &m_functionHandleId), "GetPropertyIdFromName");
+	ThrowIfError(Jsrt::GetPropertyIdFromName(L"name", &m_nameId), "GetPropertyIdFromName");
+	ThrowIfError(Jsrt::GetPropertyIdFromName(L"line", &m_lineId), "GetPropertyIdFromName");
+
+	ThrowIfError(JsDiagStartDebugging(m_runtime, &OnDebugEvent, this), "JsDiagStartDebugging");
+	m_thread = std::thread([this]() { ThreadLoop(); });
+#else
+	throw std::runtime_error("Profiling needs ChakraCore");
+#endif
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_stop.notify_one();
+	m_thread.join();
+
+#ifdef JSEXEC_CHAKRACORE
+	// A break requested just now is dropped along with debug mode.
+	void* callbackState;
+	JsDiagStopDebugging(m_runtime, &callbackState);
+#endif
+}
+
+void SamplingProfiler::ThreadLoop()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_stop.wait_for(lock, m_profile.Interval(), [this]() { return m_stopping; }))
+	{
+#ifdef JSEXEC_CHAKRACORE
+		JsDiagRequestAsyncBreak(m_runtime);
+#endif
+	}
+}
+
+void SamplingProfiler::Sample()
+{
+#ifdef JSEXEC_CHAKRACORE
+	// The frames are only valid until script resumes, read everything now. Any
+	// failure drops the sample rather than the run.
+	JsValueRef frames;
+	JsValueRef lengthValue;
+	int length;
+	if (JsDiagGetStackTrace(&frames) != JsNoError
+		|| JsGetProperty(frames, m_lengthId, &lengthValue) != JsNoError
+		|| JsNumberToInt(lengthValue, &length) != JsNoError
+		|| length <= 0)
+		return;
+
+	m_stack.clear();
+
+	// Index 0 is the innermost frame, folded stacks start at the outermost.
+	for (int i = length - 1; i >= 0; i--)
+	{
+		JsValueRef index, frame, handleValue, function, nameValue;
+		int handle;
+		if (JsIntToNumber(i, &index) != JsNoError
+			|| JsGetIndexedProperty(frames, index, &frame) != JsNoError
+			|| JsGetProperty(frame, m_functionHandleId, &handleValue) != JsNoError
+			|| JsNumberToInt(handleValue, &handle) != JsNoError
+			|| JsDiagGetObjectFromHandle(static_cast<unsigned int>(handle), &function) != JsNoError
+			|| JsGetProperty(function, m_nameId, &nameValue) != JsNoError)
+			return;
+
+		if (!m_stack.empty())
+			m_stack += ';';
+
+		const wchar_t* wzName;
+		size_t nameLength;
+		JsValueType type;
+		if (JsGetValueType(nameValue, &type) == JsNoError && type == JsString
+			&& Jsrt::StringToPointer(nameValue, &wzName, &nameLength) == JsNoError && nameLength > 0)
+		{
+			Jsrt::AppendUtf8(wzName, nameLength, m_stack);
+		}
+		else
+		{
+			// Anonymous functions are told apart by where they start.
+			JsValueRef lineValue;
+			int line = -1;
+			if (JsGetProperty(function, m_lineId, &lineValue) == JsNoError)
+				JsNumberToInt(lineValue, &line);
+			m_stack += "(anonymous):" + std::to_string(line + 1);
+		}
+	}
+
+	m_profile.AddSample(m_stack);
+#endif
+}
+
+}
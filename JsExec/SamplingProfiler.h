@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "JsWrapper.h"
+#include "JsrtCompat.h"
+
+namespace JsWrapper
+{
+
+// JS stacks sampled while a wrapper is profiling (IJsWrapper::StartProfiling
+// or ExecuteProfiled), in folded form: outermost frame first, frames joined
+// with ';'.
+class SamplingProfile
+{
+public:
+	static const unsigned kDefaultIntervalMicroseconds = 5000;
+
+	explicit SamplingProfile(std::chrono::microseconds interval = std::chrono::microseconds(kDefaultIntervalMicroseconds)) : m_interval(interval) { }
+
+	std::chrono::microseconds Interval() const { return m_interval; }
+	unsigned long long Samples() const { return m_samples; }
+
+	void AddSample(const std::string& foldedStack);
+
+	// One "outer;inner count" line per distinct stack, the input format of
+	// flamegraph.pl, inferno and speedscope.
+	std::string Folded() const;
+
+private:
+	std::chrono::microseconds m_interval;
+	std::map<std::string, unsigned long long> m_stacks;
+	unsigned long long m_samples { 0 };
+};
+
+// Samples the JS stack of one runtime for the lifetime of the object. A
+// sampling thread requests an asynchronous break (JsDiagRequestAsyncBreak)
+// every interval; the engine takes it at the next statement on the runtime
+// thread, where the stack is read (JsDiagGetStackTrace) and script resumes.
+//
+// The runtime is in debug mode meanwhile, which turns off the JIT, so only
+// run it for the work being profiled. Needs ChakraCore's diagnostic API,
+// with Edge mode JSRT the constructor throws.
+class SamplingProfiler
+{
+public:
+	// Runtime thread, with a context of the runtime current and no script running.
+	SamplingProfiler(JsRuntimeHandle runtime, SamplingProfile& profile);
+	~SamplingProfiler();
+
+	// Runtime thread, from the debug event callback.
+	void Sample();
+
+private:
+	SamplingProfiler(const SamplingProfiler&) = delete;
+	SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+	void ThreadLoop();
+
+	JsRuntimeHandle m_runtime;
+	SamplingProfile& m_profile;
+
+	JsPropertyIdRef m_lengthId { JS_INVALID_REFERENCE };
+	JsPropertyIdRef m_functionHandleId { JS_INVALID_REFERENCE };
+	JsPropertyIdRef m_nameId { JS_INVALID_REFERENCE };
+	JsPropertyIdRef m_lineId { JS_INVALID_REFERENCE };
+	std::string m_stack; // reused across samples
+
+	std::mutex m_lock;
+	std::condition_variable m_stop;
+	bool m_stopping { false };
+	std::thread m_thread;
+};
+
+}
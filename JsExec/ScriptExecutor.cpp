@@ -0,0 +1,174 @@
+#include "pch.h"
+#include "ScriptExecutor.h"
+#include "Tracer.h"
+
+#include <string>
+
+namespace JsWrapper
+{
+
+ScriptExecutor::ScriptExecutor(size_t workerCount, ConsoleFactory consoleFactory, const Settings& settings)
+	: m_consoleFactory(std::move(consoleFactory)), m_settings(settings)
+{
+	if (workerCount == 0)
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < workerCount; i++)
+		m_workers.push_back(std::make_unique<Worker>());
+
+	// Start threads only once every queue exists, workers steal from each other.
+	for (size_t i = 0; i < workerCount; i++)
+		m_workers[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
+}
+
+ScriptExecutor::~ScriptExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_idleLock);
+		m_stopping = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (auto& psWorker : m_workers)
+		psWorker->thread.join();
+}
+
+std::future<void> ScriptExecutor::Submit(std::wstring code)
+{
+	Job job;
+	job.code = std::move(code);
+	std::future<void> result = job.promise.get_future();
+
+	Worker& worker = *m_workers[m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size()];
+	{
+		std::lock_guard<std::mutex> lock(worker.lock);
+		worker.jobs.push_back(std::move(job));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_idleLock);
+		m_pending++;
+	}
+	m_workAvailable.notify_one();
+	m_submitted.fetch_add(1, std::memory_order_relaxed);
+
+	return result;
+}
+
+ScriptExecutor::Stats ScriptExecutor::GetStats() const
+{
+	return Stats { m_submitted.load(), m_completed.load(), m_stolen.load() };
+}
+
+bool ScriptExecutor::IsQueueEmpty(size_t workerIndex)
+{
+	Worker& worker = *m_workers[workerIndex];
+	std::lock_guard<std::mutex> lock(worker.lock);
+	return worker.jobs.empty();
+}
+
+bool ScriptExecutor::TakeJob(size_t workerIndex, Job& job)
+{
+	// Own queue first, oldest job first.
+	{
+		Worker& worker = *m_workers[workerIndex];
+		std::lock_guard<std::mutex> lock(worker.lock);
+		if (!worker.jobs.empty())
+		{
+			job = std::move(worker.jobs.front());
+			worker.jobs.pop_front();
+			return true;
+		}
+	}
+
+	// Steal the newest job from the next busy worker, furthest from its owner's end.
+	for (size_t offset = 1; offset < m_workers.size(); offset++)
+	{
+		Worker& victim = *m_workers[(workerIndex + offset) % m_workers.size()];
+		std::lock_guard<std::mutex> lock(victim.lock);
+		if (!victim.jobs.empty())
+		{
+			job = std::move(victim.jobs.back());
+			victim.jobs.pop_back();
+			m_stolen.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ScriptExecutor::WorkerLoop(size_t workerIndex)
+{
+	Tracer::SetThreadName("worker " + std::to_string(workerIndex));
+
+	// The wrapper is created, used and destroyed on this thread only.
+	std::unique_ptr<IJsWrapper> pWrapper;
+	std::exception_ptr creationError;
+	auto createWrapper = [&]()
+	{
+		pWrapper.reset();
+		try
+		{
+			pWrapper = CreateInstance(m_consoleFactory(workerIndex), m_settings);
+		}
+		catch (...)
+		{
+			// Keep taking jobs so they fail instead of waiting forever.
+			creationError = std::current_exception();
+		}
+	};
+	createWrapper();
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_idleLock);
+			m_workAvailable.wait(lock, [this]() { return m_stopping || m_pending > 0; });
+			if (m_pending == 0)
+				break;
+			m_pending--;
+		}
+
+		// A job counted in m_pending is in some queue until its taker removes it.
+		Job job;
+		while (!TakeJob(workerIndex, job))
+			std::this_thread::yield();
+
+		try
+		{
+			if (!pWrapper)
+				std::rethrow_exception(creationError);
+
+			// A job is done once its timers are, so it can't leave work behind for the next one.
+			pWrapper->Execute(job.code);
+			RunEventLoop(*pWrapper);
+			job.promise.set_value();
+		}
+		catch (...)
+		{
+			job.promise.set_exception(std::current_exception());
+		}
+		m_completed.fetch_add(1, std::memory_order_relaxed);
+
+		if (!pWrapper)
+			continue;
+
+		// Every job gets a fresh context, so none sees another's globals or
+		// whatever a failed one left queued. Swapping in the spare is cheap, the
+		// old context is disposed and the next spare built once the queue is empty.
+		try
+		{
+			pWrapper->ResetContext();
+			if (IsQueueEmpty(workerIndex))
+				pWrapper->RunIdleTasks();
+		}
+		catch (...)
+		{
+			// The context may be half swapped, start over with a new runtime.
+			createWrapper();
+		}
+	}
+}
+
+}
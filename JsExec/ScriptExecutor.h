@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// Runs independent scripts on several cores. Each worker thread creates and
+// owns one wrapper (its own runtime), so a wrapper only ever runs on its thread.
+// Jobs are spread over per-worker queues; an idle worker steals from the
+// others.
+//
+// Every job runs in a fresh context of its worker's runtime, so jobs don't see
+// each other's globals, timers or promise jobs.
+class ScriptExecutor
+{
+public:
+	using ConsoleFactory = std::function<std::unique_ptr<IConsole>(size_t workerIndex)>;
+
+	struct Stats
+	{
+		unsigned long long submitted;
+		unsigned long long completed;
+		unsigned long long stolen;
+	};
+
+	// workerCount 0 uses one worker per hardware thread.
+	// consoleFactory runs on each worker thread as it starts, and again if the
+	// worker has to replace a runtime it couldn't give a fresh context.
+	ScriptExecutor(size_t workerCount, ConsoleFactory consoleFactory, const Settings& settings = Settings());
+
+	// Finishes all submitted jobs, then disposes the workers' runtimes.
+	~ScriptExecutor();
+
+	// The future is ready once the script and all of its timers have run. It
+	// carries Exception::Script (or an engine failure) if the script or one of
+	// its timers throws; its remaining timers are dropped then.
+	std::future<void> Submit(std::wstring code);
+
+	size_t WorkerCount() const { return m_workers.size(); }
+	Stats GetStats() const;
+
+private:
+	struct Job
+	{
+		std::wstring code;
+		std::promise<void> promise;
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Job> jobs;
+		std::thread thread;
+	};
+
+	ScriptExecutor(const ScriptExecutor&) = delete;
+	ScriptExecutor& operator=(const ScriptExecutor&) = delete;
+
+	bool IsQueueEmpty(size_t workerIndex);
+	bool TakeJob(size_t workerIndex, Job& job);
+	void WorkerLoop(size_t workerIndex);
+
+	const ConsoleFactory m_consoleFactory;
+	const Settings m_settings;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	std::mutex m_idleLock;
+	std::condition_variable m_workAvailable;
+	size_t m_pending { 0 };   // queued, not yet taken. Guarded by m_idleLock.
+	bool m_stopping { false };
+
+	std::atomic<size_t> m_nextWorker { 0 };
+	std::atomic<unsigned long long> m_submitted { 0 };
+	std::atomic<unsigned long long> m_completed { 0 };
+	std::atomic<unsigned long long> m_stolen { 0 };
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+
+namespace JsWrapper
+{
+
+// Holds the newest value of one piece of state passed from a producer thread
+// to a consumer that only cares about the latest value, e.g. the runtime
+// thread calling set_color and the UI applying it once per frame. Publishing
+// never blocks or allocates, older values are simply overwritten.
+//
+// Triple buffered: the producer writes a spare buffer and swaps it into the
+// middle, the consumer swaps the middle out when it's marked fresh. One
+// producer thread and one consumer thread.
+template <class T>
+class StateSlot
+{
+public:
+	void Publish(const T& value)
+	{
+		m_buffers[m_back] = value;
+		unsigned previous = m_middle.exchange(m_back | kFresh, std::memory_order_acq_rel);
+		m_back = previous & kIndexMask;
+	}
+
+	// Returns false if nothing was published since the last call.
+	bool TryTake(T& value)
+	{
+		if (!(m_middle.load(std::memory_order_relaxed) & kFresh))
+			return false;
+
+		unsigned previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & kIndexMask;
+		value = m_buffers[m_front];
+		return true;
+	}
+
+private:
+	static const unsigned kIndexMask = 3;
+	static const unsigned kFresh = 4;
+
+	T m_buffers[3] {};
+	std::atomic<unsigned> m_middle { 1 };
+	unsigned m_back { 0 };  // producer only
+	unsigned m_front { 2 }; // consumer only
+};
+
+}
@@ -0,0 +1,93 @@
+#include "pch.h"
+#include "Timeline.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	// Script may have changed the values since they were validated.
+	uint32_t ToColor(double value)
+	{
+		return value >= 0 && value <= 0xFFFFFFFFu ? static_cast<uint32_t>(value) : 0;
+	}
+
+	uint32_t LerpColor(uint32_t from, uint32_t to, double t)
+	{
+		uint32_t color = 0;
+		for (unsigned shift = 0; shift < 32; shift += 8)
+		{
+			double a = (from >> shift) & 0xFF;
+			double b = (to >> shift) & 0xFF;
+			color |= static_cast<uint32_t>(a + (b - a) * t + 0.5) << shift;
+		}
+		return color;
+	}
+}
+
+namespace JsWrapper
+{
+
+void Timeline::Validate(const double* pValues, size_t count)
+{
+	if (count == 0 || count % kStride != 0)
+		throw std::invalid_argument("play_timeline expects whole keyframes of 5 values");
+
+	for (size_t i = 0; i < count; i += kStride)
+	{
+		// A timeline has to end, an infinite time never comes.
+		if (!(pValues[i] >= 0) || !std::isfinite(pValues[i]) || (i > 0 && pValues[i] < pValues[i - kStride]))
+			throw std::invalid_argument("play_timeline expects finite keyframe times in order");
+		if (!(pValues[i + 4] >= 0 && pValues[i + 4] <= 0xFFFFFFFFu))
+			throw std::invalid_argument("play_timeline expects colors as 0xAARRGGBB");
+	}
+}
+
+double Timeline::LengthMs() const
+{
+	return m_keyframes > 0 ? Keyframe(m_keyframes - 1)[0] : 0;
+}
+
+Timeline::Frame Timeline::At(double ms) const
+{
+	if (m_keyframes == 0)
+		return Frame { 0, 0, 0, 0 };
+
+	// First keyframe later than ms.
+	size_t low = 0;
+	size_t high = m_keyframes;
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if (Keyframe(middle)[0] <= ms)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	// Before the first or after the last keyframe, hold it.
+	const double* pFrom = Keyframe(low > 0 ? low - 1 : 0);
+	const double* pTo = (low > 0 && low < m_keyframes) ? Keyframe(low) : pFrom;
+
+	double span = pTo[0] - pFrom[0];
+	double t = span > 0 ? (ms - pFrom[0]) / span : 0;
+	t = t < 0 ? 0 : (t > 1 ? 1 : t);
+
+	Frame frame;
+	frame.x = pFrom[1] + (pTo[1] - pFrom[1]) * t;
+	frame.y = pFrom[2] + (pTo[2] - pFrom[2]) * t;
+	frame.z = pFrom[3] + (pTo[3] - pFrom[3]) * t;
+	frame.color = LerpColor(ToColor(pFrom[4]), ToColor(pTo[4]), t);
+	return frame;
+}
+
+void Timeline::FormatColor(uint32_t color, wchar_t (&wzColor)[10])
+{
+	const wchar_t* wzDigits = L"0123456789ABCDEF";
+	wzColor[0] = L'#';
+	for (int i = 0; i < 8; i++)
+		wzColor[1 + i] = wzDigits[(color >> (28 - 4 * i)) & 0xF];
+	wzColor[9] = L'\0';
+}
+
+}
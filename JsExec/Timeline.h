@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace JsWrapper
+{
+
+// A keyframe track as play_timeline takes it: a flat array of keyframes, each
+// kStride doubles { time in ms from the start, x, y, z in degrees, color as
+// 0xAARRGGBB }. Rotation and every color channel are interpolated linearly
+// between keyframes, before the first and after the last they hold still.
+//
+// Only a view of the values, which stay where script put them.
+class Timeline
+{
+public:
+	static const size_t kStride = 5;
+
+	struct Frame
+	{
+		double x;
+		double y;
+		double z;
+		uint32_t color;
+	};
+
+	// count is the number of doubles. Throws std::invalid_argument unless they
+	// are at least one whole keyframe, the times are finite and don't go
+	// backwards and the colors are 32 bit.
+	static void Validate(const double* pValues, size_t count);
+
+	// Doesn't validate, At stays within the values whatever they are.
+	Timeline(const double* pValues, size_t count) : m_pValues(pValues), m_keyframes(count / kStride) { }
+
+	// Time of the last keyframe. Script can make it NaN or infinite after Validate.
+	double LengthMs() const;
+
+	Frame At(double ms) const;
+
+	// "#AARRGGBB", as set_color takes it.
+	static void FormatColor(uint32_t color, wchar_t (&wzColor)[10]);
+
+private:
+	const double* Keyframe(size_t index) const { return m_pValues + index * kStride; }
+
+	const double* m_pValues;
+	size_t m_keyframes;
+};
+
+}
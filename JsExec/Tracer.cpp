@@ -0,0 +1,225 @@
+#include "pch.h"
+#include "Tracer.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "JsrtCompat.h"
+
+namespace
+{
+	using JsWrapper::Tracer;
+
+	// A ring slot guarded by a sequence lock: odd while the owning thread writes
+	// it, so a reader can tell a torn event from a whole one. The fields are
+	// relaxed atomics only to keep concurrent reads well defined.
+	struct Event
+	{
+		std::atomic<uint64_t> sequence;
+		std::atomic<const char*> szCategory;
+		std::atomic<const wchar_t*> wzName;
+		std::atomic<long long> start; // Clock ticks
+		std::atomic<long long> end;
+	};
+
+	struct ThreadBuffer
+	{
+		unsigned id;
+		std::string name;
+		bool owned; // by a running thread. Guarded by the registry lock.
+		std::atomic<uint64_t> next;
+		Event events[Tracer::kEventsPerThread];
+	};
+
+	struct Registry
+	{
+		std::mutex lock;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		unsigned nextId { 1 };
+		std::atomic<long long> epoch { 0 };
+	};
+
+	Registry& GetRegistry()
+	{
+		static Registry s_registry;
+		return s_registry;
+	}
+
+	// Hands the thread's buffer back to the registry when the thread exits.
+	// Thread locals go before statics, so the registry is still there.
+	struct BufferOwner
+	{
+		ThreadBuffer* pBuffer { nullptr };
+
+		~BufferOwner()
+		{
+			if (!pBuffer)
+				return;
+
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.lock);
+			pBuffer->owned = false;
+		}
+	};
+
+	thread_local BufferOwner t_owner;
+	thread_local std::string t_threadName;
+
+	ThreadBuffer& CurrentBuffer()
+	{
+		if (!t_owner.pBuffer)
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.lock);
+
+			// Reuse the buffer of a thread that has exited, its events go.
+			ThreadBuffer* pBuffer = nullptr;
+			for (auto& psBuffer : registry.buffers)
+			{
+				if (!psBuffer->owned)
+				{
+					pBuffer = psBuffer.get();
+					break;
+				}
+			}
+			if (!pBuffer)
+			{
+				registry.buffers.emplace_back(new ThreadBuffer());
+				pBuffer = registry.buffers.back().get();
+			}
+
+			pBuffer->next.store(0, std::memory_order_relaxed);
+			for (auto& event : pBuffer->events)
+				event.sequence.store(0, std::memory_order_relaxed);
+			pBuffer->id = registry.nextId++;
+			pBuffer->name = t_threadName;
+			pBuffer->owned = true;
+			t_owner.pBuffer = pBuffer;
+		}
+		return *t_owner.pBuffer;
+	}
+
+	void AppendEscaped(std::string& json, const std::string& text)
+	{
+		for (char ch : text)
+		{
+			if (ch == '"' || ch == '\\')
+			{
+				json += '\\';
+				json += ch;
+			}
+			else if (static_cast<unsigned char>(ch) < 0x20)
+			{
+				char szEscape[8];
+				std::snprintf(szEscape, sizeof(szEscape), "\\u%04x", ch);
+				json += szEscape;
+			}
+			else
+			{
+				json += ch;
+			}
+		}
+	}
+
+	double ToMicroseconds(long long ticks)
+	{
+		return std::chrono::duration<double, std::micro>(Tracer::Clock::duration(ticks)).count();
+	}
+}
+
+namespace JsWrapper
+{
+
+std::atomic<bool> Tracer::s_enabled { false };
+
+void Tracer::Start()
+{
+	GetRegistry().epoch.store(Clock::now().time_since_epoch().count());
+	s_enabled.store(true);
+}
+
+void Tracer::Stop()
+{
+	s_enabled.store(false);
+}
+
+void Tracer::Complete(const char* szCategory, const wchar_t* wzName, Clock::time_point start, Clock::time_point end)
+{
+	ThreadBuffer& buffer = CurrentBuffer();
+
+	uint64_t index = buffer.next.load(std::memory_order_relaxed);
+	buffer.next.store(index + 1, std::memory_order_relaxed);
+
+	Event& event = buffer.events[index % kEventsPerThread];
+	event.sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event.szCategory.store(szCategory, std::memory_order_relaxed);
+	event.wzName.store(wzName, std::memory_order_relaxed);
+	event.start.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+	event.end.store(end.time_since_epoch().count(), std::memory_order_relaxed);
+	event.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+void Tracer::SetThreadName(const std::string& name)
+{
+	t_threadName = name;
+	if (t_owner.pBuffer)
+	{
+		std::lock_guard<std::mutex> lock(GetRegistry().lock);
+		t_owner.pBuffer->name = name;
+	}
+}
+
+std::string Tracer::ToJson()
+{
+	Registry& registry = GetRegistry();
+	long long epoch = registry.epoch.load();
+
+	std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	char szNumbers[128];
+
+	std::lock_guard<std::mutex> lock(registry.lock);
+	for (auto& psBuffer : registry.buffers)
+	{
+		const ThreadBuffer& buffer = *psBuffer;
+
+		if (!buffer.name.empty())
+		{
+			std::snprintf(szNumbers, sizeof(szNumbers), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", buffer.id);
+			json += szNumbers;
+			AppendEscaped(json, buffer.name);
+			json += "\"}}";
+			first = false;
+		}
+
+		for (const Event& event : buffer.events)
+		{
+			uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+			const char* szCategory = event.szCategory.load(std::memory_order_relaxed);
+			const wchar_t* wzName = event.wzName.load(std::memory_order_relaxed);
+			long long start = event.start.load(std::memory_order_relaxed);
+			long long end = event.end.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence == 0 || (sequence & 1) != 0 || sequence != event.sequence.load(std::memory_order_relaxed))
+				continue;
+			if (start < epoch)
+				continue;
+
+			json += first ? "{\"name\":\"" : ",\n{\"name\":\"";
+			AppendEscaped(json, Jsrt::ToUtf8(wzName, std::char_traits<wchar_t>::length(wzName)));
+			json += "\",\"cat\":\"";
+			AppendEscaped(json, szCategory);
+			std::snprintf(szNumbers, sizeof(szNumbers), "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", ToMicroseconds(start - epoch), ToMicroseconds(end - start), buffer.id);
+			json += szNumbers;
+			first = false;
+		}
+	}
+
+	json += "\n]}\n";
+	return json;
+}
+
+}
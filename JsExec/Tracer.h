@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace JsWrapper
+{
+
+// Optional span tracer for finding out where a frame's time went: script,
+// host callbacks, console flushes or the UI. Output is Chrome trace-event JSON
+// ("traceEvents" with complete events), which chrome://tracing and
+// ui.perfetto.dev open directly.
+//
+// Each thread records into its own fixed size ring buffer, so recording takes
+// no lock and older events are overwritten once a thread has recorded more
+// than kEventsPerThread. A thread takes a buffer on its first event and hands
+// it back when it exits; its events stay in the trace until a new thread
+// reuses the buffer. So threads that come and go (workers, refill threads)
+// cost as many buffers as were ever tracing at once. While tracing is off a
+// span costs one relaxed load.
+//
+// Names and categories are stored by pointer and must outlive the tracer,
+// e.g. string literals or FunctionDefinition names.
+class Tracer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static const size_t kEventsPerThread = 16 * 1024;
+
+	// Events recorded before the last Start are left out of ToJson.
+	static void Start();
+	static void Stop();
+	static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	static void Complete(const char* szCategory, const wchar_t* wzName, Clock::time_point start, Clock::time_point end);
+
+	// Names the calling thread's track in the trace. Cheap, may be called before Start.
+	static void SetThreadName(const std::string& name);
+
+	// Any thread, also while tracing. Events being written at the time are skipped.
+	static std::string ToJson();
+
+private:
+	static std::atomic<bool> s_enabled;
+};
+
+// Records a complete event for the lifetime of the scope, if tracing was on when it began.
+class TraceSpan
+{
+public:
+	TraceSpan(const char* szCategory, const wchar_t* wzName) : m_szCategory(szCategory), m_wzName(wzName), m_enabled(Tracer::IsEnabled())
+	{
+		if (m_enabled)
+			m_start = Tracer::Clock::now();
+	}
+
+	~TraceSpan()
+	{
+		if (m_enabled)
+			Tracer::Complete(m_szCategory, m_wzName, m_start, Tracer::Clock::now());
+	}
+
+private:
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	const char* m_szCategory;
+	const wchar_t* m_wzName;
+	bool m_enabled;
+	Tracer::Clock::time_point m_start;
+};
+
+}
@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "Watchdog.h"
+
+#include <algorithm>
+
+namespace JsWrapper
+{
+
+std::shared_ptr<Watchdog> Watchdog::Shared()
+{
+	static std::mutex s_lock;
+	static std::weak_ptr<Watchdog> s_instance;
+
+	std::lock_guard<std::mutex> lock(s_lock);
+	std::shared_ptr<Watchdog> psWatchdog = s_instance.lock();
+	if (!psWatchdog)
+	{
+		psWatchdog = std::make_shared<Watchdog>();
+		s_instance = psWatchdog;
+	}
+	return psWatchdog;
+}
+
+Watchdog::Watchdog()
+{
+	m_thread = std::thread([this]() { ThreadLoop(); });
+}
+
+Watchdog::~Watchdog()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_deadlineChanged.notify_one();
+	m_thread.join();
+}
+
+Watchdog::Id Watchdog::Register(JsRuntimeHandle runtime)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	Id id = m_nextId++;
+	m_entries[id] = Entry { runtime, false, nullptr, false, Clock::time_point(), Outcome::Completed };
+	return id;
+}
+
+void Watchdog::Unregister(Id id)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_entries.erase(id);
+}
+
+void Watchdog::Arm(Id id, Clock::duration budget, const void* pOwner)
+{
+	bool hasDeadline = budget > Clock::duration::zero();
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		Entry& entry = m_entries.at(id);
+		entry.armed = true;
+		entry.pOwner = pOwner;
+		entry.hasDeadline = hasDeadline;
+		entry.deadline = hasDeadline ? Clock::now() + budget : Clock::time_point();
+		entry.outcome = Outcome::Completed;
+	}
+
+	if (hasDeadline)
+		m_deadlineChanged.notify_one();
+}
+
+Watchdog::Outcome Watchdog::Disarm(Id id)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	Entry& entry = m_entries.at(id);
+	entry.armed = false;
+
+	// Under the lock, so the runtime can't be stopped again after this.
+	if (entry.outcome != Outcome::Completed)
+		JsEnableRuntimeExecution(entry.runtime);
+
+	return entry.outcome;
+}
+
+void Watchdog::Cancel(Id id, const void* pOwner)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto it = m_entries.find(id);
+	if (it != m_entries.end() && it->second.armed && (pOwner == nullptr || it->second.pOwner == pOwner))
+		StopLocked(it->second, Outcome::Cancelled);
+}
+
+void Watchdog::StopLocked(Entry& entry, Outcome outcome)
+{
+	if (entry.outcome != Outcome::Completed)
+		return;
+
+	entry.outcome = outcome;
+	JsDisableRuntimeExecution(entry.runtime);
+}
+
+void Watchdog::ThreadLoop()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_stopping)
+	{
+		Clock::time_point now = Clock::now();
+		Clock::time_point nextDeadline = Clock::time_point::max();
+
+		for (auto& it : m_entries)
+		{
+			Entry& entry = it.second;
+			if (!entry.armed || !entry.hasDeadline || entry.outcome != Outcome::Completed)
+				continue;
+
+			if (entry.deadline <= now)
+				StopLocked(entry, Outcome::TimedOut);
+			else
+				nextDeadline = std::min(nextDeadline, entry.deadline);
+		}
+
+		// Arm notifies, so a new, nearer deadline is picked up on the next pass.
+		if (nextDeadline == Clock::time_point::max())
+			m_deadlineChanged.wait(lock);
+		else
+			m_deadlineChanged.wait_until(lock, nextDeadline);
+	}
+}
+
+}
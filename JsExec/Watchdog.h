@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "JsrtCompat.h"
+
+namespace JsWrapper
+{
+
+// Stops scripts that run past their time budget, or that another thread
+// cancels, by disabling their runtime (JsDisableRuntimeExecution). The script
+// then fails with JsErrorScriptTerminated and the runtime thread is free again.
+//
+// One thread serves every registered runtime and only wakes for the nearest
+// deadline. Runtimes must be created with JsRuntimeAttributeAllowScriptInterrupt.
+class Watchdog
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Id = unsigned;
+
+	enum class Outcome
+	{
+		Completed,
+		TimedOut,
+		Cancelled
+	};
+
+	// Arms for the lifetime of the scope, see Arm and Disarm.
+	class Scope
+	{
+	public:
+		Scope(Watchdog& watchdog, Id id, Clock::duration budget, const void* pOwner = nullptr) : m_watchdog(watchdog), m_id(id) { m_watchdog.Arm(m_id, budget, pOwner); }
+		~Scope() { if (!m_finished) m_watchdog.Disarm(m_id); }
+
+		Outcome Finish() { m_finished = true; return m_watchdog.Disarm(m_id); }
+
+	private:
+		Watchdog& m_watchdog;
+		Id m_id;
+		bool m_finished { false };
+	};
+
+	// The process-wide instance, created on first use and destroyed with its last user.
+	static std::shared_ptr<Watchdog> Shared();
+
+	Watchdog();
+	~Watchdog();
+
+	Id Register(JsRuntimeHandle runtime);
+	void Unregister(Id id);
+
+	// On the runtime's thread, around each call into script. A zero budget
+	// arms for Cancel only. pOwner tells apart the users of a shared runtime,
+	// see Cancel.
+	void Arm(Id id, Clock::duration budget, const void* pOwner = nullptr);
+
+	// Re-enables the runtime if it was stopped and returns why it was.
+	Outcome Disarm(Id id);
+
+	// Any thread. Stops the script the runtime is running, if it's armed, and
+	// with pOwner set only if it was armed by that owner.
+	void Cancel(Id id, const void* pOwner = nullptr);
+
+private:
+	struct Entry
+	{
+		JsRuntimeHandle runtime;
+		bool armed;
+		const void* pOwner;
+		bool hasDeadline;
+		Clock::time_point deadline;
+		Outcome outcome;
+	};
+
+	Watchdog(const Watchdog&) = delete;
+	Watchdog& operator=(const Watchdog&) = delete;
+
+	void StopLocked(Entry& entry, Outcome outcome);
+	void ThreadLoop();
+
+	std::mutex m_lock;
+	std::condition_variable m_deadlineChanged;
+	std::unordered_map<Id, Entry> m_entries;
+	Id m_nextId { 1 };
+	bool m_stopping { false };
+
+	std::thread m_thread;
+};
+
+}
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "WrapperPool.h"
+#include "Tracer.h"
+
+namespace JsWrapper
+{
+
+WrapperPool::WrapperPool(size_t capacity, ConsoleFactory consoleFactory, const Settings& settings, Refill refill)
+	: m_capacity(capacity > 0 ? capacity : 1), m_consoleFactory(std::move(consoleFactory)), m_settings(settings), m_refill(refill)
+{
+	m_ready.reserve(m_capacity);
+	m_refillThread = std::thread([this]() { RefillLoop(); });
+}
+
+WrapperPool::~WrapperPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_refillNeeded.notify_one();
+	m_refillThread.join();
+}
+
+std::unique_ptr<IJsWrapper> WrapperPool::Acquire()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_ready.empty())
+	{
+		m_stats.waited++;
+		m_wrapperReady.wait(lock, [this]() { return !m_ready.empty() || m_creationError || !WantsWrapperLocked(); });
+	}
+
+	return PopLocked();
+}
+
+std::unique_ptr<IJsWrapper> WrapperPool::TryAcquire()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_ready.empty() && !m_creationError && WantsWrapperLocked())
+		return nullptr;
+
+	return PopLocked();
+}
+
+std::unique_ptr<IJsWrapper> WrapperPool::PopLocked()
+{
+	if (m_ready.empty() && !m_creationError)
+		throw std::runtime_error("WrapperPool: all wrappers handed out");
+
+	if (m_ready.empty())
+	{
+		// Only reached with a creation error. Clear it so the refill thread tries again.
+		std::exception_ptr error = m_creationError;
+		m_creationError = nullptr;
+		m_refillNeeded.notify_one();
+		std::rethrow_exception(error);
+	}
+
+	std::unique_ptr<IJsWrapper> pWrapper = std::move(m_ready.back());
+	m_ready.pop_back();
+	m_stats.acquired++;
+	m_refillNeeded.notify_one();
+	return pWrapper;
+}
+
+// Whether the refill thread will still add one.
+bool WrapperPool::WantsWrapperLocked() const
+{
+	if (m_refill == Refill::Once && m_stats.created >= m_capacity)
+		return false;
+
+	return m_ready.size() < m_capacity;
+}
+
+WrapperPool::Stats WrapperPool::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	Stats stats = m_stats;
+	stats.ready = m_ready.size();
+	return stats;
+}
+
+void WrapperPool::RefillLoop()
+{
+	Tracer::SetThreadName("wrapper pool");
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	for (;;)
+	{
+		m_refillNeeded.wait(lock, [this]() { return m_stopping || (WantsWrapperLocked() && !m_creationError); });
+		if (m_stopping)
+			break;
+
+		// Engine creation is the slow part, don't hold up Acquire while it runs.
+		lock.unlock();
+		std::unique_ptr<IJsWrapper> pWrapper;
+		std::exception_ptr error;
+		try
+		{
+			pWrapper = CreateInstance(m_consoleFactory(), m_settings);
+
+			// The spare context too, so the first ResetContext is a swap.
+			pWrapper->RunIdleTasks();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		lock.lock();
+
+		if (pWrapper)
+		{
+			m_ready.push_back(std::move(pWrapper));
+			m_stats.created++;
+		}
+		else
+		{
+			m_creationError = error;
+		}
+		m_wrapperReady.notify_all();
+	}
+
+	// Dispose idle runtimes on this thread, not the one destroying the pool.
+	std::vector<std::unique_ptr<IJsWrapper>> idle = std::move(m_ready);
+	lock.unlock();
+	idle.clear();
+}
+
+}
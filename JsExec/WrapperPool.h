@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "JsWrapper.h"
+
+namespace JsWrapper
+{
+
+// Keeps up to `capacity` fully initialized wrappers (runtime, context and
+// globals) ready so starting a session doesn't pay for engine creation.
+// A background thread creates replacements as wrappers are handed out.
+class WrapperPool
+{
+public:
+	using ConsoleFactory = std::function<std::unique_ptr<IConsole>()>;
+
+	enum class Refill
+	{
+		Continuous, // replace every wrapper handed out
+		Once        // create capacity wrappers in all, for a host that needs no more
+	};
+
+	struct Stats
+	{
+		size_t ready;
+		unsigned long long created;
+		unsigned long long acquired;
+		unsigned long long waited; // Acquire calls that found the pool empty
+	};
+
+	// consoleFactory runs on the refill thread, once per wrapper.
+	WrapperPool(size_t capacity, ConsoleFactory consoleFactory, const Settings& settings = Settings(), Refill refill = Refill::Continuous);
+	~WrapperPool();
+
+	// Takes a ready wrapper, constant time unless the pool is empty, in which
+	// case it waits for the refill thread. Rethrows if creating a wrapper failed.
+	// With Refill::Once, throws std::runtime_error once all have been handed out.
+	std::unique_ptr<IJsWrapper> Acquire();
+
+	// Returns nullptr instead of waiting.
+	std::unique_ptr<IJsWrapper> TryAcquire();
+
+	Stats GetStats() const;
+
+private:
+	WrapperPool(const WrapperPool&) = delete;
+	WrapperPool& operator=(const WrapperPool&) = delete;
+
+	std::unique_ptr<IJsWrapper> PopLocked();
+	bool WantsWrapperLocked() const;
+	void RefillLoop();
+
+	const size_t m_capacity;
+	const ConsoleFactory m_consoleFactory;
+	const Settings m_settings;
+	const Refill m_refill;
+
+	mutable std::mutex m_lock;
+	std::condition_variable m_refillNeeded;
+	std::condition_variable m_wrapperReady;
+	std::vector<std::unique_ptr<IJsWrapper>> m_ready;
+	std::exception_ptr m_creationError;
+	bool m_stopping { false };
+	Stats m_stats {};
+
+	std::thread m_refillThread;
+};
+
+}
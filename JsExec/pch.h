@@ -5,7 +5,18 @@
 
 #pragma once
 
+#ifdef JSEXEC_CHAKRACORE
+// Portable build (CMakeLists.txt), no WinRT headers available.
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#else
 #include <collection.h>
 #include <ppltasks.h>
 
 #include "App.xaml.h"
+#endif